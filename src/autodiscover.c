@@ -9,10 +9,13 @@
 #include <cJSON.h>
 
 #include "assert.h"
+#include "types.h"
 #include "autodiscover.h"
 
 #define HTTP_POOL_SIZE 0x10000
 #define SSL_POOL_SIZE 0x40000
+// Parsed URIs smaller than this don't need their own allocation
+#define URI_POOL_SIZE 0x400
 
 int autodiscover_init(autodiscover_t *autodiscover)
 {
@@ -54,6 +57,14 @@ int autodiscover_init(autodiscover_t *autodiscover)
         return ret;
     }
 
+    // Clients are kept around between requests, so requests to the same server reuse its connection
+    ret = http_pool_init(&autodiscover->http_pool);
+    if (ret < 0)
+    {
+        SDL_Log("Failed to initialize HTTP client pool: %d", ret);
+        return ret;
+    }
+
     // Assume HTTPS until proven otherwise
     autodiscover->has_https = true;
 
@@ -143,75 +154,21 @@ https_good:
     return 0;
 }
 
-#define HTTP_USER_AGENT "RefresherPS3/1.0"
+// Nothing may be using autodiscover anymore, every job has to have been freed
+void autodiscover_deinit(autodiscover_t *autodiscover)
+{
+    http_pool_destroy(&autodiscover->http_pool);
+}
 
-int autodiscover_execute(autodiscover_t *autodiscover, char *orig_url, char **server_brand, char **patch_url, bool *patch_digest)
+// job is only passed when running on a job's thread, so the transaction can be aborted from the main thread
+static int execute(autodiscover_t *autodiscover, autodiscover_job_t *job, char *orig_url, char **server_brand, char **patch_url, bool *patch_digest)
 {
     int ret = 0;
+    // Cleared once the whole response has been read, until then the connection is in an unknown state
+    bool broken = true;
 
-    httpClientId client = 0;
-    // Create a new HTTP client
-    ret = httpCreateClient(&client);
-    if (ret < 0)
-    {
-        SDL_Log("Failed to create HTTP client: %d", ret);
-        return ret;
-    }
-
-    // Set the HTTP client options
-    httpClientSetConnTimeout(client, 10 * 1000 * 1000);
-    httpClientSetUserAgent(client, HTTP_USER_AGENT);
-    httpClientSetAutoRedirect(client, 1);
-
-    size_t orig_url_length = strlen(orig_url);
-
-    size_t i = 0;
-    bool found_protocol = false;
-    while (orig_url[i] != '\0')
-    {
-        if (orig_url[i] == '/' && orig_url[i + 1] == '/')
-        {
-            found_protocol = true;
-            break;
-        }
-
-        i++;
-    }
-
-    // Count the number of bytes before the first slash, ignoring double slashes
-    uint32_t url_length = 0;
-    for (size_t i = 0; i < orig_url_length; i++)
-    {
-        if (orig_url[i] == '/')
-        {
-            if (orig_url[i + 1] == '/')
-            {
-                i++;
-                url_length += 2;
-
-                continue;
-            }
-
-            break;
-        }
-
-        url_length++;
-    }
-
-    // Offset of bytes to leave to fit a new protocol into
-    int protocol_offset = found_protocol ? 0 : strlen("http://");
-
-    // Allocate a buffer for the URL
-    char *url = (char *)malloc(protocol_offset + url_length + 1 + strlen("/autodiscover"));
-
-    // If we did not find a protocol in the original URL, copy one in
-    if (!found_protocol)
-        strcpy(url, "http://");
-
-    // Copy the URL into the buffer
-    memcpy(url + protocol_offset, orig_url, url_length);
-    // Append the autodiscover path
-    strcpy(url + url_length + protocol_offset, "/autodiscover");
+    // Autodiscover lives at the root of the server, whatever path the URL we were given has
+    char *url = http_pool_origin_url(orig_url, "/autodiscover");
 
     SDL_Log("Constructed URL: %s", url);
 
@@ -224,7 +181,9 @@ int autodiscover_execute(autodiscover_t *autodiscover, char *orig_url, char **se
         goto uri_size_calc_fail;
     }
 
-    void *uri_pool = malloc(uri_pool_size);
+    // Most URIs fit on the stack
+    char uri_buffer[URI_POOL_SIZE];
+    void *uri_pool = uri_pool_size <= URI_POOL_SIZE ? uri_buffer : malloc(uri_pool_size);
     ASSERT_NONZERO(uri_pool, "Failed to allocate URI pool");
 
     ret = httpUtilParseUri(&uri, url, uri_pool, uri_pool_size, 0);
@@ -234,6 +193,16 @@ int autodiscover_execute(autodiscover_t *autodiscover, char *orig_url, char **se
         goto uri_parse_fail;
     }
 
+    // Get the client for this server, which may still have a connection open from last time
+    httpClientId client = 0;
+    // A cancelled job stops waiting for a client too, it can't be aborted until it has a transaction
+    ret = http_pool_acquire(&autodiscover->http_pool, &uri, &client, job != NULL ? &job->abandoned : NULL);
+    if (ret < 0)
+    {
+        SDL_Log("Failed to get HTTP client: %d", ret);
+        goto client_fail;
+    }
+
     httpTransId trans;
     ret = httpCreateTransaction(&trans, client, HTTP_METHOD_GET, &uri);
     if (ret < 0)
@@ -242,6 +211,26 @@ int autodiscover_execute(autodiscover_t *autodiscover, char *orig_url, char **se
         goto transaction_creation_fail;
     }
 
+    // Let the job be cancelled while we wait on the server
+    if (job != NULL)
+    {
+        bool abandoned = false;
+
+        MUTEX_SCOPE(
+            &job->mutex,
+            {
+                abandoned = job->abandoned;
+                job->transaction = trans;
+                job->has_transaction = !abandoned;
+            });
+
+        if (abandoned)
+        {
+            ret = -1;
+            goto request_send_fail;
+        }
+    }
+
     ret = httpSendRequest(trans, NULL, 0, NULL);
     if (ret < 0)
     {
@@ -286,24 +275,32 @@ int autodiscover_execute(autodiscover_t *autodiscover, char *orig_url, char **se
     // Allocate a buffer for the response
     char *response_buffer = (char *)malloc(content_length + 1);
     ASSERT_NONZERO(response_buffer, "Failed to allocate response buffer");
-    // Null terminate the response buffer
-    response_buffer[content_length] = '\0';
-
-    uint32_t bytes_read = 1;
-    uint32_t total_read = 0;
-    while (bytes_read > 0)
+    // Read until we have the whole body, the server closes the connection, or the request is aborted
+    uint32_t bytes_read = 0;
+    uint64_t total_read = 0;
+    while (total_read < content_length)
     {
         ret = httpRecvResponse(trans, response_buffer + total_read, content_length - total_read, &bytes_read);
+        if (ret < 0)
+        {
+            SDL_Log("Failed to receive HTTP response: %x", ret);
+            goto receive_fail;
+        }
 
-        if (ret > 0)
+        if (bytes_read == 0)
             break;
 
         total_read += bytes_read;
     }
 
+    // Null terminate whatever we got, which is only shorter than promised if the server hung up on us
+    response_buffer[total_read] = '\0';
+
+    broken = total_read != content_length;
+
     SDL_Log("Response: %s", response_buffer);
 
-    cJSON *parsed = cJSON_ParseWithLength(response_buffer, content_length);
+    cJSON *parsed = cJSON_ParseWithLength(response_buffer, total_read);
     if (parsed == NULL)
     {
         ret = -1;
@@ -351,20 +348,140 @@ json_interpret_fail:
     cJSON_Delete(parsed);
 
 json_parse_fail:
+receive_fail:
     free(response_buffer);
 
 status_code_fail:
 content_length_fail:
 request_send_fail:
+    if (job != NULL)
+    {
+        MUTEX_SCOPE(
+            &job->mutex,
+            {
+                job->has_transaction = false;
+            });
+    }
+
     httpDestroyTransaction(trans);
 
 transaction_creation_fail:
+    http_pool_release(&autodiscover->http_pool, client, broken);
+
+client_fail:
 uri_parse_fail:
-    free(uri_pool);
-    free(url);
+    if (uri_pool != uri_buffer)
+        free(uri_pool);
 
 uri_size_calc_fail:
-    ASSERT_ZERO(httpDestroyClient(client), "Failed to destroy HTTP client");
+    free(url);
 
     return ret;
-}
\ No newline at end of file
+}
+
+int autodiscover_execute(autodiscover_t *autodiscover, char *url, char **server_brand, char **patch_url, bool *patch_digest)
+{
+    return execute(autodiscover, NULL, url, server_brand, patch_url, patch_digest);
+}
+
+static void autodiscover_thread(void *arg)
+{
+    autodiscover_job_t *job = (autodiscover_job_t *)arg;
+
+    char *server_brand = NULL;
+    char *patch_url = NULL;
+    bool patch_digest = false;
+    int result = execute(job->autodiscover, job, job->url, &server_brand, &patch_url, &patch_digest);
+
+    // Hand the results over to whoever is polling the job
+    MUTEX_SCOPE(
+        &job->mutex,
+        {
+            job->result = result;
+            job->server_brand = server_brand;
+            job->patch_url = patch_url;
+            job->patch_digest = patch_digest;
+            job->running = false;
+        });
+
+    sysThreadExit(0);
+}
+
+// Starts contacting the server in the background, returns NULL if the thread can't be started
+autodiscover_job_t *autodiscover_start(autodiscover_t *autodiscover, char *url)
+{
+    autodiscover_job_t *job = (autodiscover_job_t *)malloc(sizeof(autodiscover_job_t));
+    ASSERT_NONZERO(job, "Failed to allocate autodiscover job");
+
+    memset(job, 0, sizeof(autodiscover_job_t));
+
+    job->autodiscover = autodiscover;
+    job->url = strdup(url);
+    ASSERT_NONZERO(job->url, "Failed to copy autodiscover URL");
+    job->running = true;
+
+    sys_lwmutex_attr_t mutex_attr = {
+        .name = "AUTODISC",
+        .attr_protocol = SYS_LWMUTEX_PROTOCOL_FIFO,
+        .attr_recursive = SYS_LWMUTEX_ATTR_NOT_RECURSIVE,
+    };
+
+    ASSERT_ZERO(sysLwMutexCreate(&job->mutex, &mutex_attr), "Unable to create autodiscover mutex");
+
+    // The thread is joined when the job is freed, so nothing it uses can go away underneath it
+    if (sysThreadCreate(&job->thread, autodiscover_thread, job, 1000, 0x10000, THREAD_JOINABLE, "AUTODISC") != 0)
+    {
+        SDL_Log("Failed to create autodiscover thread");
+
+        ASSERT_ZERO(sysLwMutexDestroy(&job->mutex), "Unable to destroy autodiscover mutex");
+        free(job->url);
+        free(job);
+        return NULL;
+    }
+
+    return job;
+}
+
+bool autodiscover_job_done(autodiscover_job_t *job)
+{
+    bool done = false;
+
+    MUTEX_SCOPE(
+        &job->mutex,
+        {
+            done = !job->running;
+        });
+
+    return done;
+}
+
+// Gives up on the job, its results are thrown away but it still has to be freed once it is done
+void autodiscover_job_cancel(autodiscover_job_t *job)
+{
+    MUTEX_SCOPE(
+        &job->mutex,
+        {
+            job->abandoned = true;
+
+            // Stop waiting on the server, rather than waiting out the timeout
+            if (job->has_transaction)
+                httpTransactionAbortConnection(job->transaction);
+        });
+
+    // It may still be waiting for a client, which no transaction abort reaches
+    http_pool_wake(&job->autodiscover->http_pool);
+}
+
+// Waits for the thread to finish if it hasn't yet, so this only blocks when the job isn't done
+void autodiscover_job_free(autodiscover_job_t *job)
+{
+    uint64_t ret;
+    sysThreadJoin(job->thread, &ret);
+
+    ASSERT_ZERO(sysLwMutexDestroy(&job->mutex), "Unable to destroy autodiscover mutex");
+
+    free(job->url);
+    free(job->server_brand);
+    free(job->patch_url);
+    free(job);
+}
@@ -3,8 +3,12 @@
 #include <http/util.h>
 #include <net/net.h>
 #include <sysmodule/sysmodule.h>
+#include <sys/thread.h>
+#include <sys/mutex.h>
 #include <stdbool.h>
 
+#include "http_pool.h"
+
 typedef struct autodiscover_t
 {
     void *pool;
@@ -12,7 +16,34 @@ typedef struct autodiscover_t
     void *cert_buffer;
     httpsData *ca_list;
     bool has_https;
+    http_pool_t http_pool;
 } autodiscover_t;
 
 int autodiscover_init(autodiscover_t *autodiscover);
-int autodiscover_execute(autodiscover_t *autodiscover, char *url, char **server_brand, char **patch_url, bool *patch_digest);
\ No newline at end of file
+void autodiscover_deinit(autodiscover_t *autodiscover);
+int autodiscover_execute(autodiscover_t *autodiscover, char *url, char **server_brand, char **patch_url, bool *patch_digest);
+
+// An autodiscover request running on its own thread, so the UI keeps drawing while the server is contacted
+typedef struct autodiscover_job_t
+{
+    autodiscover_t *autodiscover;
+    char *url;
+    sys_ppu_thread_t thread;
+    sys_lwmutex_t mutex;
+    // Cleared by the thread once the request is over, the results below are only valid after that
+    bool running;
+    // Set when nobody wants the result anymore, so the thread stops as soon as it can
+    bool abandoned;
+    // The transaction in flight, so it can be aborted
+    bool has_transaction;
+    httpTransId transaction;
+    int result;
+    char *server_brand;
+    char *patch_url;
+    bool patch_digest;
+} autodiscover_job_t;
+
+autodiscover_job_t *autodiscover_start(autodiscover_t *autodiscover, char *url);
+bool autodiscover_job_done(autodiscover_job_t *job);
+void autodiscover_job_cancel(autodiscover_job_t *job);
+void autodiscover_job_free(autodiscover_job_t *job);
@@ -0,0 +1,164 @@
+#include <SDL2/SDL.h>
+#include <stdio.h>
+
+#include "assert.h"
+#include "endian.h"
+#include "delta_patch.h"
+
+#define DELTA_HEADER_SIZE 24
+#define DELTA_RECORD_HEADER_SIZE 8
+
+delta_patch_t *delta_load(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+        return NULL;
+
+    // Get the size of the delta file
+    fseek(file, 0, SEEK_END);
+    size_t size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    if (size > DELTA_MAX_SIZE)
+    {
+        SDL_Log("Delta %s is too big to be valid", path);
+        fclose(file);
+        return NULL;
+    }
+
+    uint8_t *data = (uint8_t *)malloc(size);
+    ASSERT_NONZERO(data, "Unable to allocate memory for delta data");
+
+    // Read the whole file in one go, they are tiny
+    if (fread(data, 1, size, file) != size)
+    {
+        SDL_Log("Unable to read delta %s", path);
+        fclose(file);
+        free(data);
+        return NULL;
+    }
+
+    fclose(file);
+
+    return delta_parse(data, size, path);
+}
+
+// Takes ownership of data, which is freed along with the delta, or straight away if it isn't valid
+delta_patch_t *delta_parse(uint8_t *data, size_t size, const char *name)
+{
+    if (size < DELTA_HEADER_SIZE)
+    {
+        SDL_Log("Delta %s is too small to be valid", name);
+        free(data);
+        return NULL;
+    }
+
+    delta_patch_t *delta = (delta_patch_t *)malloc(sizeof(delta_patch_t));
+    ASSERT_NONZERO(delta, "Unable to allocate memory for delta");
+
+    delta->data = data;
+    delta->records = NULL;
+
+    if (_BE32(delta->data) != DELTA_MAGIC || _BE32(delta->data + 4) != DELTA_VERSION)
+    {
+        SDL_Log("Delta %s has an invalid magic or version", name);
+        goto fail;
+    }
+
+    delta->target_size = _BE64(delta->data + 8);
+    delta->target_crc32 = _BE32(delta->data + 16);
+    delta->record_count = _BE32(delta->data + 20);
+
+    // Every record takes at least a record header, so this bounds the allocation below
+    if (delta->record_count > (size - DELTA_HEADER_SIZE) / DELTA_RECORD_HEADER_SIZE)
+    {
+        SDL_Log("Delta %s claims more records than it can hold", name);
+        goto fail;
+    }
+
+    delta->records = (delta_record_t *)malloc(sizeof(delta_record_t) * (delta->record_count + 1));
+    ASSERT_NONZERO(delta->records, "Unable to allocate memory for delta records");
+
+    size_t position = DELTA_HEADER_SIZE;
+    uint64_t last_end = 0;
+    for (uint32_t i = 0; i < delta->record_count; i++)
+    {
+        if (position + DELTA_RECORD_HEADER_SIZE > size)
+        {
+            SDL_Log("Delta %s is truncated at record %d", name, i);
+            goto fail;
+        }
+
+        delta_record_t *record = &delta->records[i];
+        record->offset = _BE32(delta->data + position);
+        record->length = _BE16(delta->data + position + 4);
+        position += DELTA_RECORD_HEADER_SIZE;
+
+        if (position + record->length * 2 > size)
+        {
+            SDL_Log("Delta %s is truncated at record %d", name, i);
+            goto fail;
+        }
+
+        // Records must be sorted and must not overlap, so they can be applied and undone in one pass
+        if (record->offset < last_end || (uint64_t)record->offset + record->length > delta->target_size)
+        {
+            SDL_Log("Delta %s has an out of order or out of range record %d", name, i);
+            goto fail;
+        }
+
+        record->expected = delta->data + position;
+        record->replacement = delta->data + position + record->length;
+        position += record->length * 2;
+
+        last_end = (uint64_t)record->offset + record->length;
+    }
+
+    return delta;
+
+fail:
+    delta_free(delta);
+    return NULL;
+}
+
+void delta_free(delta_patch_t *delta)
+{
+    free(delta->records);
+    free(delta->data);
+    free(delta);
+}
+
+// image_crc32 is the crc32 of the whole image, which the caller works out once for every delta it tries
+bool delta_matches(delta_patch_t *delta, size_t image_size, uint32_t image_crc32)
+{
+    return delta->target_size == image_size && delta->target_crc32 == image_crc32;
+}
+
+int delta_apply(delta_patch_t *delta, uint8_t *image, size_t image_size)
+{
+    if (delta->target_size != image_size)
+        return -1;
+
+    // Verify and apply each record in the same pass
+    for (uint32_t i = 0; i < delta->record_count; i++)
+    {
+        delta_record_t *record = &delta->records[i];
+
+        if (memcmp(image + record->offset, record->expected, record->length) != 0)
+        {
+            SDL_Log("Delta record %d at %x does not match the image, undoing", i, record->offset);
+
+            // Put back everything we already touched, so the image is left as we found it
+            while (i-- > 0)
+                memcpy(image + delta->records[i].offset, delta->records[i].expected, delta->records[i].length);
+
+            return -1;
+        }
+
+        memcpy(image + record->offset, record->replacement, record->length);
+    }
+
+    SDL_Log("Applied %d delta records", delta->record_count);
+
+    return 0;
+}
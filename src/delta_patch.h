@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// "RDLT"
+#define DELTA_MAGIC 0x52444C54
+#define DELTA_VERSION 2
+
+// Deltas are only a few records, anything bigger than this is not one
+#define DELTA_MAX_SIZE (1024 * 1024)
+
+/*
+ * Delta file layout, all fields big endian:
+ *
+ * header:
+ *   u32 magic              "RDLT"
+ *   u32 version            DELTA_VERSION
+ *   u64 target_size        size of the decrypted image this delta applies to
+ *   u32 target_crc32       crc32 of the whole image
+ *   u32 record_count
+ *
+ * record (sorted by offset, non-overlapping):
+ *   u32 offset
+ *   u16 length
+ *   u16 reserved
+ *   u8  expected[length]
+ *   u8  replacement[length]
+ */
+
+typedef struct delta_record_t
+{
+    uint32_t offset;
+    uint16_t length;
+    const uint8_t *expected;
+    const uint8_t *replacement;
+} delta_record_t;
+
+typedef struct delta_patch_t
+{
+    uint64_t target_size;
+    uint32_t target_crc32;
+    uint32_t record_count;
+    delta_record_t *records;
+    // The raw file, which the records point into
+    uint8_t *data;
+} delta_patch_t;
+
+delta_patch_t *delta_parse(uint8_t *data, size_t size, const char *name);
+delta_patch_t *delta_load(const char *path);
+void delta_free(delta_patch_t *delta);
+bool delta_matches(delta_patch_t *delta, size_t image_size, uint32_t image_crc32);
+int delta_apply(delta_patch_t *delta, uint8_t *image, size_t image_size);
@@ -3,6 +3,9 @@
 #include <stdbool.h>
 
 #include "assert.h"
+#include "endian.h"
+#include "elf_image.h"
+#include "digest.h"
 
 #include "scetool.h"
 
@@ -38,4 +41,286 @@ bool valid_digest(char *digest)
     }
 
     return true;
-}
\ No newline at end of file
+}
+
+// Scores added up into a candidate's confidence
+#define DIGEST_SCORE_STRING 10
+#define DIGEST_SCORE_DATA_REF 20
+#define DIGEST_SCORE_CODE_REF 30
+#define DIGEST_SCORE_NEAR_COOKIE 40
+
+// How close a reference to a candidate has to be to a reference to a cookie string to count as "near"
+#define DIGEST_CODE_WINDOW 0x400
+#define DIGEST_DATA_WINDOW 0x40
+
+typedef struct digest_string_t
+{
+    uint64_t vaddr;
+    size_t offset;
+    bool is_cookie;
+    bool data_ref;
+    bool code_ref;
+    bool near_cookie;
+} digest_string_t;
+
+typedef struct digest_ref_t
+{
+    // Address of the pointer or instruction which references the string
+    uint64_t location;
+    int string;
+} digest_ref_t;
+
+// Grows a malloc'd array so it can fit one more element
+static void *grow_array(void *array, int count, int *capacity, size_t element_size)
+{
+    if (count < *capacity)
+        return array;
+
+    (*capacity) = *capacity == 0 ? 64 : *capacity * 2;
+
+    array = realloc(array, *capacity * element_size);
+    ASSERT_NONZERO(array, "Unable to grow digest locator array");
+
+    return array;
+}
+
+static int compare_strings(const void *a, const void *b)
+{
+    uint64_t a_vaddr = ((const digest_string_t *)a)->vaddr;
+    uint64_t b_vaddr = ((const digest_string_t *)b)->vaddr;
+
+    return a_vaddr < b_vaddr ? -1 : a_vaddr > b_vaddr;
+}
+
+static int compare_refs(const void *a, const void *b)
+{
+    uint64_t a_location = ((const digest_ref_t *)a)->location;
+    uint64_t b_location = ((const digest_ref_t *)b)->location;
+
+    return a_location < b_location ? -1 : a_location > b_location;
+}
+
+// Binary search for the string starting at vaddr
+static int find_string(digest_string_t *strings, int count, uint64_t vaddr)
+{
+    int low = 0;
+    int high = count - 1;
+
+    while (low <= high)
+    {
+        int middle = low + (high - low) / 2;
+
+        if (strings[middle].vaddr == vaddr)
+            return middle;
+
+        if (strings[middle].vaddr < vaddr)
+            low = middle + 1;
+        else
+            high = middle - 1;
+    }
+
+    return -1;
+}
+
+// Whether any cookie reference lies within window of location, refs must be sorted by location
+static bool near_cookie_ref(digest_string_t *strings, digest_ref_t *refs, int count, uint64_t location, uint64_t window)
+{
+    // Find the first ref at or after location - window
+    uint64_t start = location > window ? location - window : 0;
+
+    int low = 0;
+    int high = count;
+    while (low < high)
+    {
+        int middle = low + (high - low) / 2;
+
+        if (refs[middle].location < start)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+
+    for (int i = low; i < count && refs[i].location <= location + window; i++)
+    {
+        if (strings[refs[i].string].is_cookie)
+            return true;
+    }
+
+    return false;
+}
+
+int locate_digests(const uint8_t *data, size_t size, int min_confidence, digest_candidate_t *candidates, int max_candidates)
+{
+    elf_image_t image;
+    if (elf_image_parse(&image, data, size) != 0)
+        return -1;
+
+    digest_string_t *strings = NULL;
+    int string_count = 0;
+    int string_capacity = 0;
+
+    // Index every digest shaped string and every string mentioning cookies
+    for (int i = 0; i < image.segment_count; i++)
+    {
+        elf_segment_t *segment = &image.segments[i];
+        size_t end = segment->offset + segment->filesz;
+
+        size_t position = segment->offset;
+        while (position < end)
+        {
+            const char *str = (const char *)data + position;
+            size_t length = strnlen(str, end - position);
+
+            // Ignore strings which run off the end of the segment
+            if (position + length >= end)
+                break;
+
+            bool is_digest = length == DIGEST_LENGTH && valid_digest((char *)str);
+            bool is_cookie = length > 0 && (strstr(str, "cookie") != NULL || strstr(str, "Cookie") != NULL);
+
+            if (is_digest || is_cookie)
+            {
+                strings = (digest_string_t *)grow_array(strings, string_count, &string_capacity, sizeof(digest_string_t));
+
+                digest_string_t *string = &strings[string_count++];
+                memset(string, 0, sizeof(digest_string_t));
+                string->vaddr = segment->vaddr + (position - segment->offset);
+                string->offset = position;
+                string->is_cookie = is_cookie && !is_digest;
+            }
+
+            position += length + 1;
+        }
+    }
+
+    qsort(strings, string_count, sizeof(digest_string_t), compare_strings);
+
+    digest_ref_t *data_refs = NULL;
+    int data_ref_count = 0;
+    int data_ref_capacity = 0;
+
+    digest_ref_t *code_refs = NULL;
+    int code_ref_count = 0;
+    int code_ref_capacity = 0;
+
+    // The entry point is a function descriptor of { address, TOC }
+    uint64_t toc = 0;
+    size_t opd_offset;
+    if (elf_image_vaddr_to_offset(&image, image.entry, 8, &opd_offset))
+        toc = _BE32(data + opd_offset + 4);
+
+    for (int i = 0; i < image.segment_count && string_count > 0; i++)
+    {
+        elf_segment_t *segment = &image.segments[i];
+
+        for (uint64_t j = 0; j + 4 <= segment->filesz; j += 4)
+        {
+            uint32_t word = _BE32(data + segment->offset + j);
+            uint64_t location = segment->vaddr + j;
+
+            // In data, every aligned word could be a pointer, including .opd and TOC entries
+            if ((segment->flags & ELF_PF_X) == 0)
+            {
+                int string = find_string(strings, string_count, word);
+                if (string >= 0)
+                {
+                    data_refs = (digest_ref_t *)grow_array(data_refs, data_ref_count, &data_ref_capacity, sizeof(digest_ref_t));
+                    data_refs[data_ref_count++] = (digest_ref_t){.location = location, .string = string};
+                    strings[string].data_ref = true;
+                }
+
+                continue;
+            }
+
+            // In code, look for loads through the TOC, which is always in r2
+            if (toc == 0 || ((word >> 16) & 0x1F) != 2)
+                continue;
+
+            uint32_t opcode = word >> 26;
+            int16_t displacement = (int16_t)(word & 0xFFFF);
+            uint64_t target = 0;
+            size_t slot_offset;
+
+            // lwz rD, d(r2)
+            if (opcode == 32 && elf_image_vaddr_to_offset(&image, toc + displacement, 4, &slot_offset))
+                target = _BE32(data + slot_offset);
+            // ld rD, ds(r2)
+            else if (opcode == 58 && (word & 3) == 0 && elf_image_vaddr_to_offset(&image, toc + displacement, 8, &slot_offset))
+                target = _BE64(data + slot_offset);
+            // addi rD, r2, d
+            else if (opcode == 14)
+                target = toc + displacement;
+
+            int string = target != 0 ? find_string(strings, string_count, target) : -1;
+            if (string >= 0)
+            {
+                code_refs = (digest_ref_t *)grow_array(code_refs, code_ref_count, &code_ref_capacity, sizeof(digest_ref_t));
+                code_refs[code_ref_count++] = (digest_ref_t){.location = location, .string = string};
+                strings[string].code_ref = true;
+            }
+        }
+    }
+
+    // Segments are not guaranteed to be in address order
+    qsort(data_refs, data_ref_count, sizeof(digest_ref_t), compare_refs);
+    qsort(code_refs, code_ref_count, sizeof(digest_ref_t), compare_refs);
+
+    // A digest is only interesting if something near a cookie string uses it
+    for (int i = 0; i < data_ref_count; i++)
+    {
+        if (!strings[data_refs[i].string].is_cookie && near_cookie_ref(strings, data_refs, data_ref_count, data_refs[i].location, DIGEST_DATA_WINDOW))
+            strings[data_refs[i].string].near_cookie = true;
+    }
+
+    for (int i = 0; i < code_ref_count; i++)
+    {
+        if (!strings[code_refs[i].string].is_cookie && near_cookie_ref(strings, code_refs, code_ref_count, code_refs[i].location, DIGEST_CODE_WINDOW))
+            strings[code_refs[i].string].near_cookie = true;
+    }
+
+    int candidate_count = 0;
+    // Only used to say how close we got when nothing is confident enough
+    int best_confidence = 0;
+    size_t best_offset = 0;
+    for (int i = 0; i < string_count && candidate_count < max_candidates; i++)
+    {
+        digest_string_t *string = &strings[i];
+
+        if (string->is_cookie)
+            continue;
+
+        int confidence = DIGEST_SCORE_STRING;
+        if (string->data_ref)
+            confidence += DIGEST_SCORE_DATA_REF;
+        if (string->code_ref)
+            confidence += DIGEST_SCORE_CODE_REF;
+        if (string->near_cookie)
+            confidence += DIGEST_SCORE_NEAR_COOKIE;
+
+        if (confidence > 100)
+            confidence = 100;
+
+        if (confidence > best_confidence)
+        {
+            best_confidence = confidence;
+            best_offset = string->offset;
+        }
+
+        if (confidence < min_confidence)
+            continue;
+
+        candidates[candidate_count].offset = string->offset;
+        candidates[candidate_count].confidence = confidence;
+        candidate_count++;
+    }
+
+    // The candidates we did find are logged by whoever patches them
+    if (candidate_count == 0 && best_confidence > 0)
+        SDL_Log("No digest candidate reached confidence %d, best was at address %zx, %s, confidence %d", min_confidence, best_offset, data + best_offset, best_confidence);
+
+    free(strings);
+    free(data_refs);
+    free(code_refs);
+
+    return candidate_count;
+}
@@ -1,3 +1,21 @@
+#pragma once
+
 #include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define DIGEST_LENGTH 18
+
+// Candidates below this confidence are not patched
+#define DIGEST_MIN_CONFIDENCE 70
+#define DIGEST_MAX_CANDIDATES 64
+
+typedef struct digest_candidate_t
+{
+    size_t offset;
+    // 0-100, how sure we are that this string is the digest key
+    int confidence;
+} digest_candidate_t;
 
-bool valid_digest(char *digest);
\ No newline at end of file
+bool valid_digest(char *digest);
+int locate_digests(const uint8_t *data, size_t size, int min_confidence, digest_candidate_t *candidates, int max_candidates);
\ No newline at end of file
@@ -0,0 +1,92 @@
+#include <SDL2/SDL.h>
+
+#include "endian.h"
+#include "elf_image.h"
+
+// https://refspecs.linuxfoundation.org/elf/gabi4+/ch4.eheader.html
+#define ELF_HEADER_SIZE 0x40
+#define ELF_CLASS_64 2
+#define ELF_DATA_BE 2
+
+int elf_image_parse(elf_image_t *image, const uint8_t *data, size_t size)
+{
+    memset(image, 0, sizeof(elf_image_t));
+
+    image->data = data;
+    image->size = size;
+
+    if (size < ELF_HEADER_SIZE || memcmp(data, "\x7F" "ELF", 4) != 0)
+        return -1;
+
+    // We only know how to read the 64-bit big endian ELFs the PS3 uses
+    if (data[4] != ELF_CLASS_64 || data[5] != ELF_DATA_BE)
+        return -1;
+
+    image->entry = _BE64(data + 0x18);
+
+    uint64_t phoff = _BE64(data + 0x20);
+    uint16_t phentsize = _BE16(data + 0x36);
+    uint16_t phnum = _BE16(data + 0x38);
+
+    if (phentsize < 0x38 || phoff > size || (uint64_t)phnum * phentsize > size - phoff)
+        return -1;
+
+    for (int i = 0; i < phnum && image->segment_count < ELF_MAX_SEGMENTS; i++)
+    {
+        const uint8_t *phdr = data + phoff + i * phentsize;
+
+        if (_BE32(phdr) != ELF_PT_LOAD)
+            continue;
+
+        elf_segment_t *segment = &image->segments[image->segment_count];
+        segment->index = i;
+        segment->flags = _BE32(phdr + 0x04);
+        segment->offset = _BE64(phdr + 0x08);
+        segment->vaddr = _BE64(phdr + 0x10);
+        segment->filesz = _BE64(phdr + 0x20);
+        segment->memsz = _BE64(phdr + 0x28);
+
+        // Skip over segments which claim to be outside the file
+        if (segment->offset > size || segment->filesz > size - segment->offset)
+        {
+            SDL_Log("ELF segment %d is out of range", i);
+            continue;
+        }
+
+        image->segment_count++;
+    }
+
+    return image->segment_count > 0 ? 0 : -1;
+}
+
+bool elf_image_vaddr_to_offset(elf_image_t *image, uint64_t vaddr, size_t length, size_t *offset)
+{
+    for (int i = 0; i < image->segment_count; i++)
+    {
+        elf_segment_t *segment = &image->segments[i];
+
+        if (vaddr >= segment->vaddr && vaddr + length <= segment->vaddr + segment->filesz)
+        {
+            (*offset) = segment->offset + (vaddr - segment->vaddr);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool elf_image_offset_to_vaddr(elf_image_t *image, size_t offset, uint64_t *vaddr)
+{
+    for (int i = 0; i < image->segment_count; i++)
+    {
+        elf_segment_t *segment = &image->segments[i];
+
+        if (offset >= segment->offset && offset < segment->offset + segment->filesz)
+        {
+            (*vaddr) = segment->vaddr + (offset - segment->offset);
+            return true;
+        }
+    }
+
+    return false;
+}
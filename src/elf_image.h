@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define ELF_MAX_SEGMENTS 16
+
+#define ELF_PT_LOAD 1
+#define ELF_PF_X 1
+
+typedef struct elf_segment_t
+{
+    // Index of the program header this segment came from
+    int index;
+    uint32_t flags;
+    uint64_t offset;
+    uint64_t vaddr;
+    uint64_t filesz;
+    uint64_t memsz;
+} elf_segment_t;
+
+// A parsed view over a decrypted, big endian ELF64 image, as used by the PS3
+typedef struct elf_image_t
+{
+    const uint8_t *data;
+    size_t size;
+    uint64_t entry;
+    // Loadable segments only
+    elf_segment_t segments[ELF_MAX_SEGMENTS];
+    int segment_count;
+} elf_image_t;
+
+int elf_image_parse(elf_image_t *image, const uint8_t *data, size_t size);
+bool elf_image_vaddr_to_offset(elf_image_t *image, uint64_t vaddr, size_t length, size_t *offset);
+bool elf_image_offset_to_vaddr(elf_image_t *image, size_t offset, uint64_t *vaddr);
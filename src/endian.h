@@ -60,6 +60,22 @@
 #define _ES64(val) (val)
 #endif
 
+// Reads of big-endian fields from unaligned byte buffers.
+static inline uint16_t _BE16(const uint8_t *p)
+{
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static inline uint32_t _BE32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static inline uint64_t _BE64(const uint8_t *p)
+{
+    return ((uint64_t)_BE32(p) << 32) | _BE32(p + 4);
+}
+
 #ifdef __cplusplus
 }
 #endif
\ No newline at end of file
@@ -0,0 +1,391 @@
+#include <SDL2/SDL.h>
+#include <sys/stat.h>
+#include <cJSON.h>
+
+#include "assert.h"
+#include "types.h"
+#include "save_manager.h"
+#include "game_cache.h"
+
+#define GAME_CACHE_PATH GAME_DIR "games.json"
+
+#define JSON_TITLE_KEY "title"
+#define JSON_TITLE_ID_KEY "title_id"
+#define JSON_PATH_KEY "path"
+#define JSON_SELF_TYPE_KEY "self_type"
+#define JSON_PATCHABLE_KEY "patchable"
+#define JSON_DIR_MTIME_KEY "dir_mtime"
+#define JSON_SFO_SIZE_KEY "sfo_size"
+#define JSON_SFO_MTIME_KEY "sfo_mtime"
+#define JSON_EBOOT_SIZE_KEY "eboot_size"
+#define JSON_EBOOT_MTIME_KEY "eboot_mtime"
+#define JSON_STATUS_KEY "status"
+#define JSON_PATCHED_SERVER_KEY "patched_server"
+#define JSON_STATUS_EBOOT_SIZE_KEY "status_eboot_size"
+#define JSON_STATUS_EBOOT_MTIME_KEY "status_eboot_mtime"
+
+// What was cached last time, and what this scan found
+static cJSON *old_cache = NULL;
+static cJSON *new_cache = NULL;
+// Whether this scan found anything that differs from last time
+static bool cache_changed = false;
+// Every root is scanned on its own thread, and they all share the cache
+static sys_lwmutex_t cache_mutex;
+
+typedef struct game_stats_t
+{
+    uint64_t dir_mtime;
+    uint64_t sfo_size;
+    uint64_t sfo_mtime;
+    uint64_t eboot_size;
+    uint64_t eboot_mtime;
+    // The EBOOT.BIN itself, which is what patching changes, so the patch status depends on it
+    uint64_t live_eboot_size;
+    uint64_t live_eboot_mtime;
+} game_stats_t;
+
+// Everything a cached entry depends on, the executable type is read from the backup if there is one
+static int stat_game(char *path, game_stats_t *stats)
+{
+    memset(stats, 0, sizeof(game_stats_t));
+
+    char file_path[MAXPATHLEN] = {0};
+    struct stat file_stat;
+
+    if (stat(path, &file_stat) != 0)
+        return -1;
+    stats->dir_mtime = file_stat.st_mtime;
+
+    snprintf(file_path, MAXPATHLEN, "%s/PARAM.SFO", path);
+    if (stat(file_path, &file_stat) != 0)
+        return -1;
+    stats->sfo_size = file_stat.st_size;
+    stats->sfo_mtime = file_stat.st_mtime;
+
+    // A game without an EBOOT.BIN is still listed, so that stays zero
+    snprintf(file_path, MAXPATHLEN, "%s/USRDIR/EBOOT.BIN", path);
+    if (stat(file_path, &file_stat) == 0)
+    {
+        stats->eboot_size = stats->live_eboot_size = file_stat.st_size;
+        stats->eboot_mtime = stats->live_eboot_mtime = file_stat.st_mtime;
+    }
+
+    snprintf(file_path, MAXPATHLEN, "%s/USRDIR/EBOOT.BIN.ORIG", path);
+    if (stat(file_path, &file_stat) == 0)
+    {
+        stats->eboot_size = file_stat.st_size;
+        stats->eboot_mtime = file_stat.st_mtime;
+    }
+
+    return 0;
+}
+
+static bool number_matches(cJSON *object, const char *key, uint64_t value)
+{
+    cJSON *item = cJSON_GetObjectItemCaseSensitive(object, key);
+
+    return cJSON_IsNumber(item) && (uint64_t)item->valuedouble == value;
+}
+
+static void set_item(cJSON *object, const char *key, cJSON *item)
+{
+    cJSON_DeleteItemFromObjectCaseSensitive(object, key);
+    cJSON_AddItemToObject(object, key, item);
+}
+
+// Everything a cached entry is checked against when it is read back
+static void set_stats(cJSON *cached, game_stats_t *stats)
+{
+    set_item(cached, JSON_DIR_MTIME_KEY, cJSON_CreateNumber(stats->dir_mtime));
+    set_item(cached, JSON_SFO_SIZE_KEY, cJSON_CreateNumber(stats->sfo_size));
+    set_item(cached, JSON_SFO_MTIME_KEY, cJSON_CreateNumber(stats->sfo_mtime));
+    set_item(cached, JSON_EBOOT_SIZE_KEY, cJSON_CreateNumber(stats->eboot_size));
+    set_item(cached, JSON_EBOOT_MTIME_KEY, cJSON_CreateNumber(stats->eboot_mtime));
+}
+
+// Must be called with cache_mutex held
+static cJSON *find_path(cJSON *cache, char *path)
+{
+    cJSON *cached = NULL;
+    cJSON_ArrayForEach(cached, cache)
+    {
+        cJSON *cached_path = cJSON_GetObjectItemCaseSensitive(cached, JSON_PATH_KEY);
+        if (cJSON_IsString(cached_path) && strcmp(cached_path->valuestring, path) == 0)
+            return cached;
+    }
+
+    return NULL;
+}
+
+void game_cache_load()
+{
+    sys_lwmutex_attr_t mutex_attr = {
+        .name = "GCACHE",
+        .attr_protocol = SYS_LWMUTEX_PROTOCOL_FIFO,
+        .attr_recursive = SYS_LWMUTEX_ATTR_NOT_RECURSIVE,
+    };
+
+    ASSERT_ZERO(sysLwMutexCreate(&cache_mutex, &mutex_attr), "Unable to create game cache mutex");
+
+    FILE *file = fopen(GAME_CACHE_PATH, "r");
+    if (file != NULL)
+    {
+        // Get its length
+        fseek(file, 0, SEEK_END);
+        size_t file_size = ftell(file);
+        fseek(file, 0, SEEK_SET);
+
+        char *file_data = (char *)malloc(file_size);
+        ASSERT_NONZERO(file_data, "Unable to allocate memory for game cache");
+
+        if (fread(file_data, sizeof(char), file_size, file) == file_size)
+            old_cache = cJSON_ParseWithLength(file_data, file_size);
+
+        fclose(file);
+        free(file_data);
+    }
+
+    // A missing or broken cache just means every game gets read again
+    if (!cJSON_IsArray(old_cache))
+    {
+        cJSON_Delete(old_cache);
+        old_cache = cJSON_CreateArray();
+        ASSERT_NONZERO(old_cache, "Unable to create JSON array");
+    }
+
+    new_cache = cJSON_CreateArray();
+    ASSERT_NONZERO(new_cache, "Unable to create JSON array");
+
+    cache_changed = false;
+}
+
+// Must be called with cache_mutex held
+static game_list_entry *find_cached(char *path, game_stats_t *stats)
+{
+    cJSON *cached = find_path(old_cache, path);
+    if (cached == NULL)
+        return NULL;
+
+    // Only trust the entry if nothing it was read from has changed
+    if (!number_matches(cached, JSON_DIR_MTIME_KEY, stats->dir_mtime) ||
+        !number_matches(cached, JSON_SFO_SIZE_KEY, stats->sfo_size) ||
+        !number_matches(cached, JSON_SFO_MTIME_KEY, stats->sfo_mtime) ||
+        !number_matches(cached, JSON_EBOOT_SIZE_KEY, stats->eboot_size) ||
+        !number_matches(cached, JSON_EBOOT_MTIME_KEY, stats->eboot_mtime))
+        return NULL;
+
+    cJSON *title = cJSON_GetObjectItemCaseSensitive(cached, JSON_TITLE_KEY);
+    cJSON *title_id = cJSON_GetObjectItemCaseSensitive(cached, JSON_TITLE_ID_KEY);
+    cJSON *self_type = cJSON_GetObjectItemCaseSensitive(cached, JSON_SELF_TYPE_KEY);
+    cJSON *patchable = cJSON_GetObjectItemCaseSensitive(cached, JSON_PATCHABLE_KEY);
+
+    if (!cJSON_IsString(title) || !cJSON_IsString(title_id) || !cJSON_IsNumber(self_type) || !cJSON_IsBool(patchable))
+        return NULL;
+
+    game_list_entry *entry = game_list_entry_create(strdup(title->valuestring), strdup(title_id->valuestring), strdup(path));
+    entry->self_type = self_type->valueint;
+    entry->patchable = cJSON_IsTrue(patchable);
+
+    // The patch status is only as good as the EBOOT.BIN it was probed against, otherwise the probe looks again
+    cJSON *status = cJSON_GetObjectItemCaseSensitive(cached, JSON_STATUS_KEY);
+    cJSON *patched_server = cJSON_GetObjectItemCaseSensitive(cached, JSON_PATCHED_SERVER_KEY);
+    if (cJSON_IsNumber(status) &&
+        number_matches(cached, JSON_STATUS_EBOOT_SIZE_KEY, stats->live_eboot_size) &&
+        number_matches(cached, JSON_STATUS_EBOOT_MTIME_KEY, stats->live_eboot_mtime))
+    {
+        entry->status = (PATCH_STATUS)status->valueint;
+        entry->patched_server = cJSON_IsString(patched_server) ? strdup(patched_server->valuestring) : NULL;
+    }
+
+    // Carry the entry over as is
+    cJSON_AddItemToArray(new_cache, cJSON_Duplicate(cached, true));
+
+    return entry;
+}
+
+game_list_entry *game_cache_get(char *path)
+{
+    game_stats_t stats;
+    if (stat_game(path, &stats) != 0)
+        return NULL;
+
+    game_list_entry *entry = NULL;
+
+    MUTEX_SCOPE(
+        &cache_mutex,
+        {
+            entry = find_cached(path, &stats);
+        });
+
+    return entry;
+}
+
+void game_cache_put(game_list_entry *entry)
+{
+    game_stats_t stats;
+    if (stat_game(entry->path, &stats) != 0)
+        return;
+
+    cJSON *cached = cJSON_CreateObject();
+    ASSERT_NONZERO(cached, "Unable to create JSON object");
+
+    cJSON_AddItemToObject(cached, JSON_TITLE_KEY, cJSON_CreateString(entry->title));
+    cJSON_AddItemToObject(cached, JSON_TITLE_ID_KEY, cJSON_CreateString(entry->title_id));
+    cJSON_AddItemToObject(cached, JSON_PATH_KEY, cJSON_CreateString(entry->path));
+    cJSON_AddItemToObject(cached, JSON_SELF_TYPE_KEY, cJSON_CreateNumber(entry->self_type));
+    cJSON_AddItemToObject(cached, JSON_PATCHABLE_KEY, cJSON_CreateBool(entry->patchable));
+    set_stats(cached, &stats);
+
+    MUTEX_SCOPE(
+        &cache_mutex,
+        {
+            cJSON_AddItemToArray(new_cache, cached);
+
+            cache_changed = true;
+        });
+}
+
+static int write_cache(cJSON *cache)
+{
+    char *json_string = cJSON_PrintUnformatted(cache);
+    ASSERT_NONZERO(json_string, "Unable to convert JSON to string");
+
+    int result = 0;
+
+    FILE *file = fopen(GAME_CACHE_PATH, "w");
+    if (file != NULL)
+    {
+        fputs(json_string, file);
+        fclose(file);
+    }
+    else
+    {
+        SDL_Log("Unable to open game cache for writing");
+        result = -1;
+    }
+
+    cJSON_free(json_string);
+
+    return result;
+}
+
+// Remembers what a probe found, along with the EBOOT.BIN it looked at, so the next launch doesn't have to probe again
+// The change is written out by the next merge
+void game_cache_set_status(char *path, PATCH_STATUS status, char *patched_server)
+{
+    game_stats_t stats;
+    if (stat_game(path, &stats) != 0)
+        return;
+
+    MUTEX_SCOPE(
+        &cache_mutex,
+        {
+            // The game may be in either, depending on whether a scan is reading it right now
+            cJSON *caches[] = {old_cache, new_cache};
+            for (int i = 0; i < 2; i++)
+            {
+                cJSON *cached = find_path(caches[i], path);
+                if (cached == NULL)
+                    continue;
+
+                // Patching writes the backup, which the entry is checked against, and nothing else it was read from
+                set_stats(cached, &stats);
+
+                set_item(cached, JSON_STATUS_KEY, cJSON_CreateNumber(status));
+                set_item(cached, JSON_STATUS_EBOOT_SIZE_KEY, cJSON_CreateNumber(stats.live_eboot_size));
+                set_item(cached, JSON_STATUS_EBOOT_MTIME_KEY, cJSON_CreateNumber(stats.live_eboot_mtime));
+
+                if (patched_server != NULL)
+                    set_item(cached, JSON_PATCHED_SERVER_KEY, cJSON_CreateString(patched_server));
+                else
+                    cJSON_DeleteItemFromObjectCaseSensitive(cached, JSON_PATCHED_SERVER_KEY);
+
+                cache_changed = true;
+            }
+        });
+}
+
+// Must be called with cache_mutex held
+static bool remove_cached(cJSON *cache, char *path)
+{
+    int i = 0;
+    cJSON *cached = NULL;
+    cJSON_ArrayForEach(cached, cache)
+    {
+        cJSON *cached_path = cJSON_GetObjectItemCaseSensitive(cached, JSON_PATH_KEY);
+        if (cJSON_IsString(cached_path) && strcmp(cached_path->valuestring, path) == 0)
+        {
+            cJSON_DeleteItemFromArray(cache, i);
+            return true;
+        }
+
+        i++;
+    }
+
+    return false;
+}
+
+// Only called once every root has been scanned
+int game_cache_save()
+{
+    int result = 0;
+
+    MUTEX_SCOPE(
+        &cache_mutex,
+        {
+            // Games that were removed also need to be dropped from the cache
+            if (cJSON_GetArraySize(new_cache) != cJSON_GetArraySize(old_cache))
+                cache_changed = true;
+
+            if (cache_changed)
+                result = write_cache(new_cache);
+
+            // What we found this time is what the next scan compares against
+            cJSON_Delete(old_cache);
+            old_cache = new_cache;
+            new_cache = cJSON_CreateArray();
+            ASSERT_NONZERO(new_cache, "Unable to create JSON array");
+
+            cache_changed = false;
+        });
+
+    return result;
+}
+
+// Drops a game which has been deleted, the change is written out by the next merge
+void game_cache_forget(char *path)
+{
+    MUTEX_SCOPE(
+        &cache_mutex,
+        {
+            cache_changed |= remove_cached(old_cache, path);
+        });
+}
+
+// Called after only some of the roots were read again, so games which weren't looked at are kept
+int game_cache_merge()
+{
+    int result = 0;
+
+    MUTEX_SCOPE(
+        &cache_mutex,
+        {
+            // Whatever was read this time replaces what we had for the same game
+            cJSON *cached = NULL;
+            while ((cached = cJSON_DetachItemFromArray(new_cache, 0)) != NULL)
+            {
+                cJSON *cached_path = cJSON_GetObjectItemCaseSensitive(cached, JSON_PATH_KEY);
+                if (cJSON_IsString(cached_path))
+                    remove_cached(old_cache, cached_path->valuestring);
+
+                cJSON_AddItemToArray(old_cache, cached);
+            }
+
+            if (cache_changed)
+                result = write_cache(old_cache);
+
+            cache_changed = false;
+        });
+
+    return result;
+}
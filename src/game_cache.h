@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "game_list.h"
+
+void game_cache_load();
+game_list_entry *game_cache_get(char *path);
+void game_cache_put(game_list_entry *entry);
+int game_cache_save();
+void game_cache_forget(char *path);
+int game_cache_merge();
+void game_cache_set_status(char *path, PATCH_STATUS status, char *patched_server);
@@ -1,3 +1,5 @@
+#include <strings.h>
+
 #include "game_list.h"
 
 #include "assert.h"
@@ -7,10 +9,16 @@ game_list_entry *game_list_entry_create(char *title, char *title_id, char *path)
     game_list_entry *entry = (game_list_entry *)malloc(sizeof(game_list_entry));
     ASSERT_NONZERO(entry, "Failed to allocate memory for game_list_entry");
 
+    entry->id = -1;
     entry->title = title;
     entry->title_id = title_id;
     entry->path = path;
-    entry->next = NULL;
+    entry->self_type = 0;
+    entry->patchable = false;
+    entry->source = GAME_SOURCE_HDD;
+    entry->mtime = 0;
+    entry->status = PATCH_STATUS_UNKNOWN;
+    entry->patched_server = NULL;
     return entry;
 }
 
@@ -19,5 +27,211 @@ void game_list_entry_destroy(game_list_entry *entry)
     free(entry->title);
     free(entry->title_id);
     free(entry->path);
+    free(entry->patched_server);
     free(entry);
-}
\ No newline at end of file
+}
+
+void game_list_init(game_list_t *list, GAME_SORT sort)
+{
+    memset(list, 0, sizeof(game_list_t));
+
+    list->sort = sort;
+}
+
+// Negative if a is shown before b
+static int compare_games(game_list_t *list, int a_id, int b_id)
+{
+    game_list_entry *a = list->entries[a_id];
+    game_list_entry *b = list->entries[b_id];
+
+    int result = 0;
+    switch (list->sort)
+    {
+    case GAME_SORT_TITLE:
+        result = strcasecmp(a->title, b->title);
+        break;
+    case GAME_SORT_TITLE_ID:
+        result = strcmp(a->title_id, b->title_id);
+        break;
+    case GAME_SORT_RECENT:
+        result = a->mtime == b->mtime ? 0 : (a->mtime > b->mtime ? -1 : 1);
+        break;
+    default:
+        break;
+    }
+
+    // Fall back to the order they were found in, so the order is always the same
+    return result != 0 ? result : a_id - b_id;
+}
+
+// Puts an id into the view where it belongs, the view must have room for it
+static void insert_into_view(game_list_t *list, int view_count, int id)
+{
+    // Binary search for the first game that should be shown after this one
+    int low = 0;
+    int high = view_count;
+    while (low < high)
+    {
+        int middle = (low + high) / 2;
+
+        if (compare_games(list, list->view[middle], id) < 0)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+
+    memmove(list->view + low + 1, list->view + low, sizeof(int) * (view_count - low));
+    list->view[low] = id;
+}
+
+static void rebuild_view(game_list_t *list)
+{
+    int view_count = 0;
+    for (int id = 0; id < list->id_count; id++)
+    {
+        if (list->entries[id] != NULL)
+            insert_into_view(list, view_count++, id);
+    }
+
+    list->version++;
+}
+
+int game_list_add(game_list_t *list, game_list_entry *entry)
+{
+    if (list->id_count == list->capacity)
+    {
+        list->capacity = list->capacity == 0 ? 64 : list->capacity * 2;
+
+        list->entries = (game_list_entry **)realloc(list->entries, sizeof(game_list_entry *) * list->capacity);
+        ASSERT_NONZERO(list->entries, "Failed to allocate memory for game list");
+
+        list->view = (int *)realloc(list->view, sizeof(int) * list->capacity);
+        ASSERT_NONZERO(list->view, "Failed to allocate memory for game list view");
+    }
+
+    entry->id = list->id_count++;
+    list->entries[entry->id] = entry;
+
+    insert_into_view(list, list->count, entry->id);
+    list->count++;
+    list->version++;
+
+    return entry->id;
+}
+
+void game_list_replace(game_list_t *list, int id, game_list_entry *entry)
+{
+    game_list_entry_destroy(list->entries[id]);
+
+    entry->id = id;
+    list->entries[id] = entry;
+
+    // The new copy might sort differently
+    rebuild_view(list);
+}
+
+void game_list_remove(game_list_t *list, int id)
+{
+    int index = game_list_view_index(list, id);
+    if (index < 0)
+        return;
+
+    game_list_entry_destroy(list->entries[id]);
+    list->entries[id] = NULL;
+
+    // Close the gap in the view, everything else stays in the same order
+    memmove(list->view + index, list->view + index + 1, sizeof(int) * (list->count - index - 1));
+    list->count--;
+    list->version++;
+}
+
+game_list_entry *game_list_get(game_list_t *list, int id)
+{
+    if (id < 0 || id >= list->id_count)
+        return NULL;
+
+    return list->entries[id];
+}
+
+int game_list_find_title_id(game_list_t *list, char *title_id)
+{
+    for (int id = 0; id < list->id_count; id++)
+    {
+        if (list->entries[id] != NULL && strcmp(list->entries[id]->title_id, title_id) == 0)
+            return id;
+    }
+
+    return -1;
+}
+
+int game_list_find_path(game_list_t *list, char *path)
+{
+    for (int id = 0; id < list->id_count; id++)
+    {
+        if (list->entries[id] != NULL && strcmp(list->entries[id]->path, path) == 0)
+            return id;
+    }
+
+    return -1;
+}
+
+game_list_entry *game_list_get_view(game_list_t *list, int index)
+{
+    if (index < 0 || index >= list->count)
+        return NULL;
+
+    return list->entries[list->view[index]];
+}
+
+int game_list_view_index(game_list_t *list, int id)
+{
+    for (int i = 0; i < list->count; i++)
+    {
+        if (list->view[i] == id)
+            return i;
+    }
+
+    return -1;
+}
+
+void game_list_set_sort(game_list_t *list, GAME_SORT sort)
+{
+    list->sort = sort;
+
+    rebuild_view(list);
+}
+
+// Returns where in the view the first game whose title starts with prefix is, or -1
+int game_list_find_prefix(game_list_t *list, char *prefix)
+{
+    size_t length = strlen(prefix);
+
+    // Sorted by title, the matches are all next to each other, so binary search for the first one
+    if (list->sort == GAME_SORT_TITLE)
+    {
+        int low = 0;
+        int high = list->count;
+        while (low < high)
+        {
+            int middle = (low + high) / 2;
+
+            if (strncasecmp(list->entries[list->view[middle]]->title, prefix, length) < 0)
+                low = middle + 1;
+            else
+                high = middle;
+        }
+
+        if (low < list->count && strncasecmp(list->entries[list->view[low]]->title, prefix, length) == 0)
+            return low;
+
+        return -1;
+    }
+
+    for (int i = 0; i < list->count; i++)
+    {
+        if (strncasecmp(list->entries[list->view[i]]->title, prefix, length) == 0)
+            return i;
+    }
+
+    return -1;
+}
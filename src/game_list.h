@@ -1,20 +1,134 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <stdbool.h>
 
 #ifndef GAME_LIST_H
 #define GAME_LIST_H
 
+// Where a game was found, in order of preference when the same game is in more than one place
+typedef enum GAME_SOURCE
+{
+    GAME_SOURCE_HDD = 0,
+    GAME_SOURCE_USB,
+    GAME_SOURCE_DISC,
+} GAME_SOURCE;
+
+inline char *get_game_source_name(GAME_SOURCE source)
+{
+    switch (source)
+    {
+    case GAME_SOURCE_HDD:
+        return "HDD";
+    case GAME_SOURCE_USB:
+        return "USB";
+    case GAME_SOURCE_DISC:
+        return "Disc";
+    default:
+        return "Unknown";
+    }
+}
+
+// What the game's EBOOT.BIN currently is, worked out in the background after the scan
+typedef enum PATCH_STATUS
+{
+    // Not probed yet
+    PATCH_STATUS_UNKNOWN = 0,
+    PATCH_STATUS_STOCK,
+    PATCH_STATUS_PATCHED,
+    // The game was updated after it was patched, so the backup no longer matches the installed EBOOT.BIN
+    PATCH_STATUS_STALE,
+    PATCH_STATUS_UNPATCHABLE,
+} PATCH_STATUS;
+
+inline char *get_patch_status_name(PATCH_STATUS status)
+{
+    switch (status)
+    {
+    case PATCH_STATUS_STOCK:
+        return "Stock";
+    case PATCH_STATUS_PATCHED:
+        return "Patched";
+    case PATCH_STATUS_STALE:
+        return "Updated since patching";
+    case PATCH_STATUS_UNPATCHABLE:
+        return "Not patchable";
+    default:
+        return "Unknown";
+    }
+}
+
+typedef enum GAME_SORT
+{
+    GAME_SORT_TITLE = 0,
+    GAME_SORT_TITLE_ID,
+    // Most recently installed or updated first
+    GAME_SORT_RECENT,
+    GAME_SORT_COUNT,
+} GAME_SORT;
+
+inline char *get_game_sort_name(GAME_SORT sort)
+{
+    switch (sort)
+    {
+    case GAME_SORT_TITLE:
+        return "Title";
+    case GAME_SORT_TITLE_ID:
+        return "Title ID";
+    case GAME_SORT_RECENT:
+        return "Recent";
+    default:
+        return "Unknown";
+    }
+}
+
 typedef struct game_list_entry
 {
-    struct game_list_entry *next;
+    // Index into the list's entries, which never changes once the game is added, and is never reused
+    int id;
     char *title;
     char *title_id;
     char *path;
+    // Read from the header of the EBOOT.BIN when the game is found, SELF_TYPE_* or 0 if unknown
+    uint32_t self_type;
+    bool patchable;
+    GAME_SOURCE source;
+    // When the game's directory last changed, for sorting by recency
+    uint64_t mtime;
+    PATCH_STATUS status;
+    // Name of the server the game was patched to, if the status is patched and we know it
+    char *patched_server;
 } game_list_entry;
 
+typedef struct game_list_t
+{
+    // Indexed by id, games are never moved, only replaced with a better copy, removed games leave a NULL behind
+    game_list_entry **entries;
+    int id_count;
+    int capacity;
+    // How many games are in the list
+    int count;
+    // Ids in the order they are shown, always count long
+    int *view;
+    GAME_SORT sort;
+    // Bumped whenever the view changes, so the UI knows to find its selection again
+    uint32_t version;
+} game_list_t;
+
 game_list_entry *game_list_entry_create(char *title, char *title_id, char *path);
 
 void game_list_entry_destroy(game_list_entry *entry);
 
-#endif
\ No newline at end of file
+void game_list_init(game_list_t *list, GAME_SORT sort);
+int game_list_add(game_list_t *list, game_list_entry *entry);
+void game_list_replace(game_list_t *list, int id, game_list_entry *entry);
+void game_list_remove(game_list_t *list, int id);
+game_list_entry *game_list_get(game_list_t *list, int id);
+int game_list_find_title_id(game_list_t *list, char *title_id);
+int game_list_find_path(game_list_t *list, char *path);
+game_list_entry *game_list_get_view(game_list_t *list, int index);
+int game_list_view_index(game_list_t *list, int id);
+void game_list_set_sort(game_list_t *list, GAME_SORT sort);
+int game_list_find_prefix(game_list_t *list, char *prefix);
+
+#endif
@@ -1,75 +1,598 @@
 #include <SDL2/SDL.h>
 #include <dirent.h>
 #include <stdio.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/thread.h>
+#include <strings.h>
+#include <cJSON.h>
 
 #include "paramsfo.h"
 #include "game_list.h"
+#include "games.h"
+#include "self_info.h"
+#include "game_cache.h"
+#include "save_manager.h"
 #include "assert.h"
 
-int iterate_games(const char *path, game_list_entry **list, uint32_t *count)
+// Lets the places games are looked for be changed without rebuilding, the table below is used if it is missing
+#define GAME_ROOTS_PATH GAME_DIR "game_roots.json"
+
+#define JSON_PATH_KEY "path"
+#define JSON_LAYOUT_KEY "layout"
+#define JSON_SOURCE_KEY "source"
+
+// Upper bound on how many roots can be configured, each one gets its own thread while scanning
+#define GAME_ROOT_MAX 32
+
+typedef enum GAME_ROOT_LAYOUT
 {
-    DIR *directory = NULL;
-    directory = opendir(path);
-    ASSERT_NONZERO(directory, "Failed to open game directory");
+    // Every directory inside the root named after a title id is a game, like /dev_hdd0/game
+    GAME_ROOT_LAYOUT_TITLE_DIRS = 0,
+    // The root itself is a game, like a disc's PS3_GAME
+    GAME_ROOT_LAYOUT_SINGLE,
+    // Every directory inside the root has a game in its PS3_GAME, like a backup manager's GAMES folder
+    GAME_ROOT_LAYOUT_BACKUP_DIRS,
+} GAME_ROOT_LAYOUT;
+
+typedef struct game_root_t
+{
+    char path[256];
+    GAME_ROOT_LAYOUT layout;
+    GAME_SOURCE source;
+} game_root_t;
+
+typedef struct game_path_list_t
+{
+    char **paths;
+    int count;
+} game_path_list_t;
+
+// A directory which couldn't be read as a game, and what it looked like at the time
+typedef struct failed_game_t
+{
+    char *path;
+    uint64_t mtime;
+} failed_game_t;
+
+typedef struct failed_game_list_t
+{
+    failed_game_t *games;
+    int count;
+} failed_game_list_t;
+
+// What a root looked like when it was last read, so only roots which have changed get read again
+typedef struct root_watch_t
+{
+    bool present;
+    uint64_t mtime;
+    // Every directory in the root which could hold a game
+    game_path_list_t paths;
+    // Directories which couldn't be read, they are only read again once they change
+    failed_game_list_t failed;
+    // Set when a game couldn't be removed yet, so the root is read again next time
+    bool stale;
+} root_watch_t;
+
+typedef struct game_scan_t
+{
+    const game_root_t *root;
+    root_watch_t *watch;
+    game_found_func_t on_found;
+    void *arg;
+    sys_ppu_thread_t thread;
+    bool started;
+} game_scan_t;
+
+// Every place games are looked for by default, each one is scanned on its own thread so a slow drive doesn't hold up the rest
+static const game_root_t default_game_roots[] = {
+    {"/dev_hdd0/game", GAME_ROOT_LAYOUT_TITLE_DIRS, GAME_SOURCE_HDD},
+    {"/dev_bdvd/PS3_GAME", GAME_ROOT_LAYOUT_SINGLE, GAME_SOURCE_DISC},
+    {"/dev_usb000/GAMES", GAME_ROOT_LAYOUT_BACKUP_DIRS, GAME_SOURCE_USB},
+    {"/dev_usb001/GAMES", GAME_ROOT_LAYOUT_BACKUP_DIRS, GAME_SOURCE_USB},
+    {"/dev_usb002/GAMES", GAME_ROOT_LAYOUT_BACKUP_DIRS, GAME_SOURCE_USB},
+    {"/dev_usb003/GAMES", GAME_ROOT_LAYOUT_BACKUP_DIRS, GAME_SOURCE_USB},
+    {"/dev_usb004/GAMES", GAME_ROOT_LAYOUT_BACKUP_DIRS, GAME_SOURCE_USB},
+    {"/dev_usb005/GAMES", GAME_ROOT_LAYOUT_BACKUP_DIRS, GAME_SOURCE_USB},
+    {"/dev_usb006/GAMES", GAME_ROOT_LAYOUT_BACKUP_DIRS, GAME_SOURCE_USB},
+    {"/dev_usb007/GAMES", GAME_ROOT_LAYOUT_BACKUP_DIRS, GAME_SOURCE_USB},
+};
+
+#define DEFAULT_GAME_ROOT_COUNT (sizeof(default_game_roots) / sizeof(default_game_roots[0]))
+
+// The roots in use, loaded once by the first scan
+static game_root_t game_roots[GAME_ROOT_MAX];
+static int game_root_count = 0;
+
+// Each root's watch is only touched by the thread scanning it, then only by the thread polling for changes
+static root_watch_t root_watches[GAME_ROOT_MAX];
+
+static int parse_root_layout(const char *name, GAME_ROOT_LAYOUT *layout)
+{
+    if (strcasecmp(name, "title_dirs") == 0)
+        (*layout) = GAME_ROOT_LAYOUT_TITLE_DIRS;
+    else if (strcasecmp(name, "single") == 0)
+        (*layout) = GAME_ROOT_LAYOUT_SINGLE;
+    else if (strcasecmp(name, "backup_dirs") == 0)
+        (*layout) = GAME_ROOT_LAYOUT_BACKUP_DIRS;
+    else
+        return -1;
+
+    return 0;
+}
+
+static int parse_root_source(const char *name, GAME_SOURCE *source)
+{
+    for (GAME_SOURCE i = GAME_SOURCE_HDD; i <= GAME_SOURCE_DISC; i++)
+    {
+        if (strcasecmp(name, get_game_source_name(i)) == 0)
+        {
+            (*source) = i;
+            return 0;
+        }
+    }
+
+    return -1;
+}
 
-    // Initialize the count to 0
-    (*count) = 0;
-    // Initialize the list to NULL
-    (*list) = NULL;
+// Reads the configured roots, returning how many there are, or -1 if there is no usable configuration
+static int read_game_roots()
+{
+    FILE *file = fopen(GAME_ROOTS_PATH, "r");
+    if (file == NULL)
+        return -1;
+
+    // Get its length
+    fseek(file, 0, SEEK_END);
+    size_t file_size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    char *file_data = (char *)malloc(file_size);
+    ASSERT_NONZERO(file_data, "Unable to allocate memory for game roots");
+
+    cJSON *json = NULL;
+    if (fread(file_data, sizeof(char), file_size, file) == file_size)
+        json = cJSON_ParseWithLength(file_data, file_size);
+
+    fclose(file);
+    free(file_data);
+
+    if (!cJSON_IsArray(json))
+    {
+        SDL_Log("%s is not a list of roots, using the default roots", GAME_ROOTS_PATH);
+        cJSON_Delete(json);
+        return -1;
+    }
+
+    int count = 0;
+    cJSON *item = NULL;
+    cJSON_ArrayForEach(item, json)
+    {
+        if (count >= GAME_ROOT_MAX)
+        {
+            SDL_Log("Only the first %d game roots are used", GAME_ROOT_MAX);
+            break;
+        }
+
+        cJSON *path = cJSON_GetObjectItemCaseSensitive(item, JSON_PATH_KEY);
+        cJSON *layout = cJSON_GetObjectItemCaseSensitive(item, JSON_LAYOUT_KEY);
+        cJSON *source = cJSON_GetObjectItemCaseSensitive(item, JSON_SOURCE_KEY);
+
+        game_root_t *root = &game_roots[count];
+
+        // Skip over roots we can't make sense of, rather than throwing the rest away
+        if (!cJSON_IsString(path) || !cJSON_IsString(layout) || !cJSON_IsString(source) ||
+            strlen(path->valuestring) >= sizeof(root->path) ||
+            parse_root_layout(layout->valuestring, &root->layout) != 0 ||
+            parse_root_source(source->valuestring, &root->source) != 0)
+        {
+            SDL_Log("Skipping invalid game root %d in %s", count, GAME_ROOTS_PATH);
+            continue;
+        }
+
+        strcpy(root->path, path->valuestring);
+        count++;
+    }
+
+    cJSON_Delete(json);
+
+    return count;
+}
+
+static void load_game_roots()
+{
+    if (game_root_count > 0)
+        return;
+
+    game_root_count = read_game_roots();
+    if (game_root_count > 0)
+    {
+        SDL_Log("Loaded %d game roots from %s", game_root_count, GAME_ROOTS_PATH);
+        return;
+    }
+
+    memcpy(game_roots, default_game_roots, sizeof(default_game_roots));
+    game_root_count = DEFAULT_GAME_ROOT_COUNT;
+}
+
+static void add_game_path(game_path_list_t *list, const char *path)
+{
+    list->paths = (char **)realloc(list->paths, sizeof(char *) * (list->count + 1));
+    ASSERT_NONZERO(list->paths, "Unable to allocate memory for game paths");
+
+    list->paths[list->count] = strdup(path);
+    ASSERT_NONZERO(list->paths[list->count], "Unable to allocate memory for game path");
+
+    list->count++;
+}
+
+static bool has_game_path(game_path_list_t *list, const char *path)
+{
+    for (int i = 0; i < list->count; i++)
+    {
+        if (strcmp(list->paths[i], path) == 0)
+            return true;
+    }
+
+    return false;
+}
+
+static void remove_game_path(game_path_list_t *list, int index)
+{
+    free(list->paths[index]);
+
+    list->count--;
+    memmove(&list->paths[index], &list->paths[index + 1], sizeof(char *) * (list->count - index));
+}
+
+// When a directory was last changed, or 0 if it is gone
+static uint64_t get_path_mtime(const char *path)
+{
+    struct stat path_stat;
+    return stat(path, &path_stat) == 0 ? path_stat.st_mtime : 0;
+}
+
+static void add_failed_game(failed_game_list_t *list, const char *path, uint64_t mtime)
+{
+    list->games = (failed_game_t *)realloc(list->games, sizeof(failed_game_t) * (list->count + 1));
+    ASSERT_NONZERO(list->games, "Unable to allocate memory for failed games");
+
+    list->games[list->count].path = strdup(path);
+    ASSERT_NONZERO(list->games[list->count].path, "Unable to allocate memory for game path");
+    list->games[list->count].mtime = mtime;
+
+    list->count++;
+}
+
+// Whether the directory already failed to read, and hasn't changed since
+static bool is_failed_game(failed_game_list_t *list, const char *path, uint64_t mtime)
+{
+    for (int i = 0; i < list->count; i++)
+    {
+        if (strcmp(list->games[i].path, path) == 0)
+            return list->games[i].mtime == mtime;
+    }
+
+    return false;
+}
+
+// Whether any directory that failed to read has been written to or removed since
+static bool failed_games_changed(failed_game_list_t *list)
+{
+    for (int i = 0; i < list->count; i++)
+    {
+        if (get_path_mtime(list->games[i].path) != list->games[i].mtime)
+            return true;
+    }
+
+    return false;
+}
+
+static void free_failed_games(failed_game_list_t *list)
+{
+    for (int i = 0; i < list->count; i++)
+        free(list->games[i].path);
+
+    free(list->games);
+    memset(list, 0, sizeof(failed_game_list_t));
+}
+
+static void free_game_paths(game_path_list_t *list)
+{
+    for (int i = 0; i < list->count; i++)
+        free(list->paths[i]);
+
+    free(list->paths);
+    memset(list, 0, sizeof(game_path_list_t));
+}
+
+// Reads a single game directory, the one holding PARAM.SFO and USRDIR
+// The title id is taken from the PARAM.SFO, unless the directory is named after it
+static game_list_entry *read_game(char *game_path, char *title_id, GAME_SOURCE source)
+{
+    // If nothing changed since last time, use what we read then
+    game_list_entry *game = game_cache_get(game_path);
+
+    if (game == NULL)
+    {
+        char param_sfo_path[MAXPATHLEN] = {0};
+        // Get the path to the PARAM.SFO file
+        snprintf(param_sfo_path, MAXPATHLEN, "%s/PARAM.SFO", game_path);
+
+        // Try to read the game's info
+        sfo_info_t sfo_info;
+        // If it fails, skip over the game
+        if (read_sfo(param_sfo_path, &sfo_info) != 0 || !sfo_info.has_title || (title_id == NULL && sfo_info.title_id[0] == '\0'))
+        {
+            SDL_Log("Unable to get title for %s", param_sfo_path);
+            return NULL;
+        }
 
-    game_list_entry *last_entry = NULL;
+        game = game_list_entry_create(strdup(sfo_info.title), strdup(title_id != NULL ? title_id : sfo_info.title_id), strdup(game_path));
+
+        // Read what kind of executable the game has, preferring the backup since the EBOOT.BIN may already be patched
+        char eboot_path[MAXPATHLEN] = {0};
+        snprintf(eboot_path, MAXPATHLEN, "%s/USRDIR/EBOOT.BIN.ORIG", game_path);
+        if (access(eboot_path, F_OK) != 0)
+            snprintf(eboot_path, MAXPATHLEN, "%s/USRDIR/EBOOT.BIN", game_path);
+
+        self_info_t self_info;
+        if (self_info_get(eboot_path, &self_info) == 0)
+        {
+            game->self_type = self_info.self_type;
+            game->patchable = self_info_is_patchable(&self_info);
+        }
+
+        // Remember it for next time
+        game_cache_put(game);
+    }
+
+    game->source = source;
+
+    // Used to sort by the most recently installed or updated games
+    struct stat game_stat;
+    if (stat(game_path, &game_stat) == 0)
+        game->mtime = game_stat.st_mtime;
+
+    // Discs are read only, so there is nowhere to write the patched EBOOT.BIN
+    if (source == GAME_SOURCE_DISC)
+        game->patchable = false;
+
+    return game;
+}
+
+// Lists every directory in a root that could hold a game
+static void list_root(const game_root_t *root, game_path_list_t *list)
+{
+    if (root->layout == GAME_ROOT_LAYOUT_SINGLE)
+    {
+        // Most of the time there is no disc in the drive
+        if (access(root->path, F_OK) == 0)
+            add_game_path(list, root->path);
+
+        return;
+    }
+
+    DIR *directory = NULL;
+    directory = opendir(root->path);
+    if (directory == NULL)
+    {
+        // Drives which aren't plugged in are expected
+        if (root->source == GAME_SOURCE_HDD)
+            SDL_Log("Failed to open game directory %s", root->path);
+
+        return;
+    }
 
     struct dirent *entry = NULL;
     while ((entry = readdir(directory)) != NULL)
     {
+        if (entry->d_type != DT_DIR || strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+
         char full_path[MAXPATHLEN + 2] = {0};
-        snprintf(full_path, MAXPATHLEN + 2, "%s/%s", path, entry->d_name);
 
-        if (entry->d_type == DT_DIR)
+        if (root->layout == GAME_ROOT_LAYOUT_TITLE_DIRS)
         {
-            // Skip over . and .. and non-9 character directories
-            if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0 && strlen(entry->d_name) == 9)
-            {
-                // Skip over non-games
-                if (memcmp(entry->d_name, "NP", 2) != 0 && entry->d_name[0] != 'B')
-                    continue;
-
-                SDL_Log("Found game: %s, full path: %s", entry->d_name, full_path);
-
-                char param_sfo_path[MAXPATHLEN] = {0};
-                // Get the path to the PARAM.SFO file
-                snprintf(param_sfo_path, MAXPATHLEN, "%s/PARAM.SFO", full_path);
-
-                // Try to get the title of the game
-                char *title = get_title(param_sfo_path);
-                // If it fails, skip over the game
-                if (title == NULL)
-                {
-                    SDL_Log("Unable to get title for %s", param_sfo_path);
-                    continue;
-                }
-
-                // Add the game to the list
-                game_list_entry *next_entry = game_list_entry_create(strdup(title), strdup(entry->d_name), strdup(full_path));
-
-                // If the list isn't empty, add the entry to the end of the list
-                if (*list != NULL)
-                {
-                    last_entry->next = next_entry;
-                    last_entry = next_entry;
-                }
-                // Otherwise, set the start of the list to the entry
-                else
-                {
-                    (*list) = next_entry;
-                    last_entry = next_entry;
-                }
-
-                (*count)++;
-            }
+            // Skip over non-9 character directories
+            if (strlen(entry->d_name) != 9)
+                continue;
+
+            // Skip over non-games
+            if (memcmp(entry->d_name, "NP", 2) != 0 && entry->d_name[0] != 'B')
+                continue;
+
+            snprintf(full_path, MAXPATHLEN + 2, "%s/%s", root->path, entry->d_name);
         }
+        else
+        {
+            snprintf(full_path, MAXPATHLEN + 2, "%s/%s/PS3_GAME", root->path, entry->d_name);
+
+            // Anything else people keep in there isn't a game
+            if (access(full_path, F_OK) != 0)
+                continue;
+        }
+
+        add_game_path(list, full_path);
     }
 
     closedir(directory);
+}
+
+static game_list_entry *read_root_game(const game_root_t *root, char *path)
+{
+    // Games on the HDD are in a directory named after their title id
+    char *title_id = root->layout == GAME_ROOT_LAYOUT_TITLE_DIRS ? strrchr(path, '/') + 1 : NULL;
+
+    SDL_Log("Found game: %s", path);
+
+    return read_game(path, title_id, root->source);
+}
+
+// Whether the root is there, and when its list of directories last changed
+static void stat_root(const game_root_t *root, root_watch_t *watch)
+{
+    struct stat root_stat;
+    watch->present = stat(root->path, &root_stat) == 0;
+    watch->mtime = watch->present ? root_stat.st_mtime : 0;
+}
+
+static void iterate_root(const game_root_t *root, root_watch_t *watch, game_found_func_t on_found, void *arg)
+{
+    stat_root(root, watch);
+    list_root(root, &watch->paths);
+
+    for (int i = 0; i < watch->paths.count; i++)
+    {
+        char *path = watch->paths.paths[i];
+
+        // Take the mtime before reading, so anything written while we read makes the next poll look again
+        uint64_t mtime = get_path_mtime(path);
+
+        game_list_entry *game = read_root_game(root, path);
+
+        // It may still be being copied, so read it again once something is written to it
+        if (game == NULL)
+        {
+            add_failed_game(&watch->failed, path, mtime);
+            remove_game_path(&watch->paths, i--);
+            continue;
+        }
+
+        // Hand the game over straight away, so it shows up while we keep looking
+        on_found(game, arg);
+    }
+}
+
+static void game_scan_thread(void *arg)
+{
+    game_scan_t *scan = (game_scan_t *)arg;
+
+    iterate_root(scan->root, scan->watch, scan->on_found, scan->arg);
+
+    sysThreadExit(0);
+}
+
+int iterate_games(game_found_func_t on_found, void *arg)
+{
+    load_game_roots();
+
+    game_scan_t scans[GAME_ROOT_MAX];
+    memset(scans, 0, sizeof(scans));
+
+    for (int i = 0; i < game_root_count; i++)
+    {
+        scans[i].root = &game_roots[i];
+        scans[i].watch = &root_watches[i];
+        scans[i].on_found = on_found;
+        scans[i].arg = arg;
+
+        if (sysThreadCreate(&scans[i].thread, game_scan_thread, &scans[i], 1000, 0x10000, THREAD_JOINABLE, "SCANROOT") == 0)
+            scans[i].started = true;
+        // If we can't get a thread, just scan it here
+        else
+            iterate_root(scans[i].root, scans[i].watch, on_found, arg);
+    }
+
+    for (int i = 0; i < game_root_count; i++)
+    {
+        if (!scans[i].started)
+            continue;
+
+        uint64_t ret;
+        sysThreadJoin(scans[i].thread, &ret);
+    }
+
+    // Write out what changed, and drop games which are gone
+    game_cache_save();
+
     return 0;
-}
\ No newline at end of file
+}
+
+int poll_games(game_found_func_t on_found, game_removed_func_t on_removed, void *arg)
+{
+    int changes = 0;
+
+    for (int i = 0; i < game_root_count; i++)
+    {
+        const game_root_t *root = &game_roots[i];
+        root_watch_t *watch = &root_watches[i];
+
+        // Adding or removing a directory changes the mtime of the one it is in, so most of the time this is all we do
+        root_watch_t now;
+        memset(&now, 0, sizeof(root_watch_t));
+        stat_root(root, &now);
+
+        if (!watch->stale && now.present == watch->present && now.mtime == watch->mtime && !failed_games_changed(&watch->failed))
+            continue;
+
+        SDL_Log("%s changed, looking for added and removed games", root->path);
+
+        if (now.present)
+            list_root(root, &now.paths);
+
+        bool deferred = false;
+
+        for (int j = 0; j < watch->paths.count; j++)
+        {
+            char *path = watch->paths.paths[j];
+
+            if (has_game_path(&now.paths, path))
+                continue;
+
+            if (on_removed(path, arg))
+            {
+                game_cache_forget(path);
+                changes++;
+            }
+            // Keep it around, so removing it is tried again next time
+            else
+            {
+                add_game_path(&now.paths, path);
+                deferred = true;
+            }
+        }
+
+        for (int j = 0; j < now.paths.count; j++)
+        {
+            char *path = now.paths.paths[j];
+
+            if (has_game_path(&watch->paths, path))
+                continue;
+
+            uint64_t mtime = get_path_mtime(path);
+
+            // Don't keep reading a directory that failed before until something in it changes
+            if (is_failed_game(&watch->failed, path, mtime))
+            {
+                add_failed_game(&now.failed, path, mtime);
+                remove_game_path(&now.paths, j--);
+                continue;
+            }
+
+            game_list_entry *game = read_root_game(root, path);
+
+            // It may still be being copied, copying files into it doesn't change the root's mtime, so it is watched on its own
+            if (game == NULL)
+            {
+                add_failed_game(&now.failed, path, mtime);
+                remove_game_path(&now.paths, j--);
+                continue;
+            }
+
+            on_found(game, arg);
+            changes++;
+        }
+
+        free_game_paths(&watch->paths);
+        free_failed_games(&watch->failed);
+        (*watch) = now;
+        watch->stale = deferred;
+    }
+
+    // Write out the games which were added or removed
+    if (changes > 0)
+        game_cache_merge();
+
+    return changes;
+}
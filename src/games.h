@@ -1,5 +1,20 @@
+#pragma once
+
 #include <stdio.h>
+#include <stdbool.h>
 
 #include "game_list.h"
 
-int iterate_games(const char *path, game_list_entry **list, uint32_t *count);
\ No newline at end of file
+// Called for every game as soon as it is found, the callee takes ownership of the entry
+typedef void (*game_found_func_t)(game_list_entry *entry, void *arg);
+
+// Scans every game root at once, only returning once they are all done
+// on_found is called from the scanning threads, so it has to be thread safe
+int iterate_games(game_found_func_t on_found, void *arg);
+
+// Called for every game which was deleted since it was found, returning false if it can't be removed from the list right now
+typedef bool (*game_removed_func_t)(char *path, void *arg);
+
+// Only reads the roots whose list of games has changed since they were last read, and returns how many games were added or removed
+// Must not be called at the same time as iterate_games
+int poll_games(game_found_func_t on_found, game_removed_func_t on_removed, void *arg);
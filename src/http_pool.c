@@ -0,0 +1,429 @@
+#include <SDL2/SDL.h>
+#include <strings.h>
+
+#include "assert.h"
+#include "types.h"
+#include "http_pool.h"
+
+#define HTTP_USER_AGENT "RefresherPS3/1.0"
+#define HTTP_CONNECT_TIMEOUT_US (10 * 1000 * 1000)
+
+static bool origin_matches(http_origin_t *origin, httpUri *uri)
+{
+    return origin->used &&
+           !origin->broken &&
+           origin->port == uri->port &&
+           strcasecmp(origin->scheme, uri->scheme) == 0 &&
+           strcasecmp(origin->hostname, uri->hostname) == 0;
+}
+
+static void close_origin(http_origin_t *origin)
+{
+    SDL_Log("Closing HTTP client for %s://%s:%d", origin->scheme, origin->hostname, origin->port);
+
+    ASSERT_ZERO(httpDestroyClient(origin->client), "Failed to destroy HTTP client");
+    memset(origin, 0, sizeof(http_origin_t));
+}
+
+// Must be called with the pool mutex held
+static void evict_idle(http_pool_t *pool)
+{
+    uint32_t now = SDL_GetTicks();
+
+    for (int i = 0; i < HTTP_POOL_MAX_ORIGINS; i++)
+    {
+        http_origin_t *origin = &pool->origins[i];
+
+        if (origin->used && origin->in_use == 0 && now - origin->last_used_ticks >= HTTP_POOL_IDLE_MS)
+            close_origin(origin);
+    }
+}
+
+// Finds somewhere to put a new client, closing the least recently used idle one if the pool is full
+// Must be called with the pool mutex held
+static http_origin_t *find_free_origin(http_pool_t *pool)
+{
+    http_origin_t *oldest = NULL;
+
+    for (int i = 0; i < HTTP_POOL_MAX_ORIGINS; i++)
+    {
+        http_origin_t *origin = &pool->origins[i];
+
+        if (!origin->used)
+            return origin;
+
+        if (origin->in_use == 0 && (oldest == NULL || origin->last_used_ticks < oldest->last_used_ticks))
+            oldest = origin;
+    }
+
+    if (oldest != NULL)
+        close_origin(oldest);
+
+    return oldest;
+}
+
+static int create_client(http_origin_t *origin, httpUri *uri)
+{
+    int ret = httpCreateClient(&origin->client);
+    if (ret < 0)
+    {
+        SDL_Log("Failed to create HTTP client: %d", ret);
+        return ret;
+    }
+
+    // Set the HTTP client options
+    httpClientSetConnTimeout(origin->client, HTTP_CONNECT_TIMEOUT_US);
+    httpClientSetUserAgent(origin->client, HTTP_USER_AGENT);
+    httpClientSetAutoRedirect(origin->client, 1);
+
+    // Keep the connection open after each request, so the next one skips the TCP and TLS handshakes
+    httpClientSetKeepAlive(origin->client, 1);
+    httpClientSetPerHostKeepAliveMax(origin->client, HTTP_POOL_PER_HOST_MAX);
+
+    origin->used = true;
+    snprintf(origin->scheme, sizeof(origin->scheme), "%s", uri->scheme);
+    snprintf(origin->hostname, sizeof(origin->hostname), "%s", uri->hostname);
+    origin->port = uri->port;
+
+    SDL_Log("Created HTTP client for %s://%s:%d", origin->scheme, origin->hostname, origin->port);
+
+    return 0;
+}
+
+// Waits for any client to be released, failing once the request has waited out its deadline or been abandoned
+// Must be called with the pool mutex held
+static int wait_for_release(http_pool_t *pool, uint32_t start_ticks, bool *abandoned)
+{
+    // Only ever goes from false to true, and http_pool_wake takes the pool mutex after it is set, so this sees it
+    if (abandoned != NULL && *abandoned)
+        return -1;
+
+    uint32_t waited = SDL_GetTicks() - start_ticks;
+    if (waited >= HTTP_POOL_ACQUIRE_TIMEOUT_MS)
+        return -1;
+
+    // Timing out is expected, the deadline is checked again before the next wait
+    sysLwCondWait(&pool->released_cond, (uint64_t)(HTTP_POOL_ACQUIRE_TIMEOUT_MS - waited) * 1000);
+
+    return 0;
+}
+
+int http_pool_init(http_pool_t *pool)
+{
+    memset(pool, 0, sizeof(http_pool_t));
+
+    sys_lwmutex_attr_t mutex_attr = {
+        .name = "HTTPPOOL",
+        .attr_protocol = SYS_LWMUTEX_PROTOCOL_FIFO,
+        .attr_recursive = SYS_LWMUTEX_ATTR_NOT_RECURSIVE,
+    };
+
+    ASSERT_ZERO(sysLwMutexCreate(&pool->mutex, &mutex_attr), "Unable to create HTTP pool mutex");
+
+    sys_lwcond_attr_t cond_attr = {.name = "HTTPREL"};
+    ASSERT_ZERO(sysLwCondCreate(&pool->released_cond, &pool->mutex, &cond_attr), "Unable to create HTTP pool condition");
+
+    return 0;
+}
+
+// Nothing may be using the pool anymore
+void http_pool_destroy(http_pool_t *pool)
+{
+    for (int i = 0; i < HTTP_POOL_MAX_ORIGINS; i++)
+    {
+        if (pool->origins[i].used)
+            close_origin(&pool->origins[i]);
+    }
+
+    ASSERT_ZERO(sysLwCondDestroy(&pool->released_cond), "Unable to destroy HTTP pool condition");
+    ASSERT_ZERO(sysLwMutexDestroy(&pool->mutex), "Unable to destroy HTTP pool mutex");
+}
+
+// Gets the client for the server the URI points at, waiting if too many requests are already being made to it
+// Every client handed out must be given back with http_pool_release
+// Fails if no client frees up within HTTP_POOL_ACQUIRE_TIMEOUT_MS, so stuck requests can't hold up every later one forever
+// abandoned may be NULL, otherwise the wait is given up once it is set and http_pool_wake is called
+int http_pool_acquire(http_pool_t *pool, httpUri *uri, httpClientId *client, bool *abandoned)
+{
+    int ret = 0;
+    uint32_t start_ticks = SDL_GetTicks();
+
+    ASSERT_ZERO(sysLwMutexLock(&pool->mutex, 0), "Unable to lock HTTP pool mutex");
+
+    evict_idle(pool);
+
+    while (true)
+    {
+        http_origin_t *origin = NULL;
+        for (int i = 0; i < HTTP_POOL_MAX_ORIGINS && origin == NULL; i++)
+        {
+            if (origin_matches(&pool->origins[i], uri))
+                origin = &pool->origins[i];
+        }
+
+        // There is already a client for this server, so use it once it has room
+        if (origin != NULL)
+        {
+            if (origin->in_use >= HTTP_POOL_PER_HOST_MAX)
+            {
+                ret = wait_for_release(pool, start_ticks, abandoned);
+                if (ret != 0)
+                {
+                    SDL_Log("Gave up waiting for a connection to %s", uri->hostname);
+                    break;
+                }
+
+                continue;
+            }
+
+            origin->in_use++;
+            (*client) = origin->client;
+            break;
+        }
+
+        origin = find_free_origin(pool);
+
+        // Every client is busy, so wait for one to be done with
+        if (origin == NULL)
+        {
+            ret = wait_for_release(pool, start_ticks, abandoned);
+            if (ret != 0)
+            {
+                SDL_Log("Gave up waiting for a free HTTP client");
+                break;
+            }
+
+            continue;
+        }
+
+        ret = create_client(origin, uri);
+        if (ret < 0)
+            break;
+
+        origin->in_use++;
+        (*client) = origin->client;
+        break;
+    }
+
+    ASSERT_ZERO(sysLwMutexUnlock(&pool->mutex), "Unable to unlock HTTP pool mutex");
+
+    return ret;
+}
+
+// broken is set when the request did not finish cleanly, its connection can't be trusted to be reused
+void http_pool_release(http_pool_t *pool, httpClientId client, bool broken)
+{
+    MUTEX_SCOPE(
+        &pool->mutex,
+        {
+            for (int i = 0; i < HTTP_POOL_MAX_ORIGINS; i++)
+            {
+                http_origin_t *origin = &pool->origins[i];
+
+                if (origin->used && origin->client == client)
+                {
+                    origin->in_use--;
+                    origin->last_used_ticks = SDL_GetTicks();
+                    origin->broken |= broken;
+
+                    // New requests already get a fresh client, so close this one once the last request is done with it
+                    if (origin->broken && origin->in_use == 0)
+                        close_origin(origin);
+
+                    break;
+                }
+            }
+
+            ASSERT_ZERO(sysLwCondSignalAll(&pool->released_cond), "Unable to signal HTTP pool condition");
+        });
+}
+
+// Wakes every request waiting for a client, so ones which were abandoned notice
+void http_pool_wake(http_pool_t *pool)
+{
+    MUTEX_SCOPE(
+        &pool->mutex,
+        {
+            ASSERT_ZERO(sysLwCondSignalAll(&pool->released_cond), "Unable to signal HTTP pool condition");
+        });
+}
+
+// Builds a URL on the same server as url, with path in place of whatever path url had
+// Users type server URLs in by hand, so http:// is assumed if there is no scheme
+char *http_pool_origin_url(char *url, char *path)
+{
+    size_t url_length = strlen(url);
+
+    bool found_protocol = strstr(url, "//") != NULL;
+
+    // Count the number of bytes before the first slash, ignoring double slashes
+    size_t origin_length = 0;
+    for (size_t i = 0; i < url_length; i++)
+    {
+        if (url[i] == '/')
+        {
+            if (url[i + 1] == '/')
+            {
+                i++;
+                origin_length += 2;
+
+                continue;
+            }
+
+            break;
+        }
+
+        origin_length++;
+    }
+
+    // Offset of bytes to leave to fit a new protocol into
+    int protocol_offset = found_protocol ? 0 : strlen("http://");
+
+    char *origin_url = (char *)malloc(protocol_offset + origin_length + strlen(path) + 1);
+    ASSERT_NONZERO(origin_url, "Failed to allocate URL");
+
+    // If we did not find a protocol in the original URL, copy one in
+    if (!found_protocol)
+        strcpy(origin_url, "http://");
+
+    memcpy(origin_url + protocol_offset, url, origin_length);
+    strcpy(origin_url + protocol_offset + origin_length, path);
+
+    return origin_url;
+}
+
+// GETs url into a buffer the caller frees, failing on anything but a 200 or a body bigger than max_size
+int http_pool_fetch(http_pool_t *pool, char *url, size_t max_size, uint8_t **data, size_t *size)
+{
+    int ret = 0;
+    // Cleared once the whole response has been read, until then the connection is in an unknown state
+    bool broken = true;
+
+    uint32_t uri_pool_size;
+    httpUri uri;
+    ret = httpUtilParseUri(&uri, url, NULL, 0, &uri_pool_size);
+    if (ret < 0)
+    {
+        SDL_Log("Failed to calculate URI size: %x", ret);
+        return ret;
+    }
+
+    void *uri_pool = malloc(uri_pool_size);
+    ASSERT_NONZERO(uri_pool, "Failed to allocate URI pool");
+
+    ret = httpUtilParseUri(&uri, url, uri_pool, uri_pool_size, 0);
+    if (ret < 0)
+    {
+        SDL_Log("Failed to parse URI: %x", ret);
+        goto uri_parse_fail;
+    }
+
+    httpClientId client = 0;
+    ret = http_pool_acquire(pool, &uri, &client, NULL);
+    if (ret < 0)
+    {
+        SDL_Log("Failed to get HTTP client: %d", ret);
+        goto client_fail;
+    }
+
+    httpTransId trans;
+    ret = httpCreateTransaction(&trans, client, HTTP_METHOD_GET, &uri);
+    if (ret < 0)
+    {
+        SDL_Log("Failed to create HTTP transaction: %x", ret);
+        goto transaction_creation_fail;
+    }
+
+    ret = httpSendRequest(trans, NULL, 0, NULL);
+    if (ret < 0)
+    {
+        SDL_Log("Failed to send HTTP request: %x", ret);
+        goto request_fail;
+    }
+
+    int32_t response_code = 0;
+    ret = httpResponseGetStatusCode(trans, &response_code);
+    if (ret < 0)
+    {
+        SDL_Log("Failed to get HTTP response status code: %x", ret);
+        goto request_fail;
+    }
+
+    if (response_code != HTTP_STATUS_CODE_OK)
+    {
+        ret = -1;
+
+        SDL_Log("%s returned status code %d", url, response_code);
+        goto request_fail;
+    }
+
+    uint64_t content_length;
+    ret = httpResponseGetContentLength(trans, &content_length);
+    if (ret < 0)
+    {
+        SDL_Log("Failed to get HTTP response content length: %x", ret);
+        goto request_fail;
+    }
+
+    // The server decides how much we allocate, so don't let it ask for more than the caller expects
+    if (content_length > max_size)
+    {
+        ret = -1;
+
+        SDL_Log("%s is too big, %llu bytes", url, (unsigned long long)content_length);
+        goto request_fail;
+    }
+
+    char *buffer = (char *)malloc(content_length + 1);
+    ASSERT_NONZERO(buffer, "Failed to allocate response buffer");
+
+    // Read until we have the whole body, the server closes the connection, or the request fails
+    uint32_t bytes_read = 0;
+    uint64_t total_read = 0;
+    while (total_read < content_length)
+    {
+        ret = httpRecvResponse(trans, buffer + total_read, content_length - total_read, &bytes_read);
+        if (ret < 0)
+        {
+            SDL_Log("Failed to receive HTTP response: %x", ret);
+            goto receive_fail;
+        }
+
+        if (bytes_read == 0)
+            break;
+
+        total_read += bytes_read;
+    }
+
+    if (total_read != content_length)
+    {
+        ret = -1;
+
+        SDL_Log("%s was cut short, got %llu of %llu bytes", url, (unsigned long long)total_read, (unsigned long long)content_length);
+        goto receive_fail;
+    }
+
+    broken = false;
+
+    (*data) = (uint8_t *)buffer;
+    (*size) = total_read;
+
+    // If we made it here, no errors occurred
+    ret = 0;
+
+receive_fail:
+    if (ret != 0)
+        free(buffer);
+
+request_fail:
+    httpDestroyTransaction(trans);
+
+transaction_creation_fail:
+    http_pool_release(pool, client, broken);
+
+client_fail:
+uri_parse_fail:
+    free(uri_pool);
+
+    return ret;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <http/http.h>
+#include <http/util.h>
+#include <sys/mutex.h>
+#include <sys/cond.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// How many servers we keep clients around for at once
+#define HTTP_POOL_MAX_ORIGINS 8
+// How many requests may be made to the same server at once
+#define HTTP_POOL_PER_HOST_MAX 2
+// Clients which haven't been used for this long are closed the next time the pool is used
+#define HTTP_POOL_IDLE_MS (60 * 1000)
+// How long a request waits for a busy server or a full pool before giving up
+#define HTTP_POOL_ACQUIRE_TIMEOUT_MS (15 * 1000)
+
+// One client per scheme, host and port, so its kept alive connections are reused by every request to that server
+typedef struct http_origin_t
+{
+    bool used;
+    char scheme[8];
+    char hostname[128];
+    uint32_t port;
+    httpClientId client;
+    // Requests currently using the client
+    int in_use;
+    uint32_t last_used_ticks;
+    // Set when a request on the client was aborted or failed part way, it is closed once nobody is using it
+    bool broken;
+} http_origin_t;
+
+typedef struct http_pool_t
+{
+    http_origin_t origins[HTTP_POOL_MAX_ORIGINS];
+    sys_lwmutex_t mutex;
+    // Signalled whenever a request is done with its client
+    sys_lwcond_t released_cond;
+} http_pool_t;
+
+int http_pool_init(http_pool_t *pool);
+void http_pool_destroy(http_pool_t *pool);
+int http_pool_acquire(http_pool_t *pool, httpUri *uri, httpClientId *client, bool *abandoned);
+void http_pool_release(http_pool_t *pool, httpClientId client, bool broken);
+void http_pool_wake(http_pool_t *pool);
+
+char *http_pool_origin_url(char *url, char *path);
+int http_pool_fetch(http_pool_t *pool, char *url, size_t max_size, uint8_t **data, size_t *size);
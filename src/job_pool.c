@@ -0,0 +1,145 @@
+#include <SDL2/SDL.h>
+
+#include "assert.h"
+#include "job_pool.h"
+
+static void job_pool_worker(void *arg)
+{
+    job_pool_t *pool = (job_pool_t *)arg;
+
+    while (true)
+    {
+        ASSERT_ZERO(sysLwMutexLock(&pool->mutex, 0), "Unable to lock job pool mutex");
+
+        // Sleep until there is something to do
+        while (pool->head == NULL && !pool->stopping)
+            ASSERT_ZERO(sysLwCondWait(&pool->work_cond, 0), "Unable to wait on job pool condition");
+
+        // If we are stopping and the queue is drained, exit out
+        if (pool->head == NULL)
+        {
+            ASSERT_ZERO(sysLwMutexUnlock(&pool->mutex), "Unable to unlock job pool mutex");
+            break;
+        }
+
+        // Pop the next job off the queue
+        job_t *job = pool->head;
+        pool->head = job->next;
+        if (pool->head == NULL)
+            pool->tail = NULL;
+
+        pool->busy++;
+
+        ASSERT_ZERO(sysLwMutexUnlock(&pool->mutex), "Unable to unlock job pool mutex");
+
+        job->func(job->arg);
+        free(job);
+
+        ASSERT_ZERO(sysLwMutexLock(&pool->mutex, 0), "Unable to lock job pool mutex");
+
+        pool->busy--;
+
+        // Wake up anyone waiting for the pool to go idle
+        if (pool->head == NULL && pool->busy == 0)
+            ASSERT_ZERO(sysLwCondSignalAll(&pool->idle_cond), "Unable to signal job pool condition");
+
+        ASSERT_ZERO(sysLwMutexUnlock(&pool->mutex), "Unable to unlock job pool mutex");
+    }
+
+    sysThreadExit(0);
+}
+
+int job_pool_create(job_pool_t *pool, int thread_count, uint64_t stack_size, char *name)
+{
+    memset(pool, 0, sizeof(job_pool_t));
+
+    sys_lwmutex_attr_t mutex_attr = {
+        .name = "JOBPOOL",
+        .attr_protocol = SYS_LWMUTEX_PROTOCOL_FIFO,
+        .attr_recursive = SYS_LWMUTEX_ATTR_NOT_RECURSIVE,
+    };
+
+    ASSERT_ZERO(sysLwMutexCreate(&pool->mutex, &mutex_attr), "Unable to create job pool mutex");
+
+    sys_lwcond_attr_t work_cond_attr = {.name = "JOBWORK"};
+    ASSERT_ZERO(sysLwCondCreate(&pool->work_cond, &pool->mutex, &work_cond_attr), "Unable to create job pool condition");
+
+    sys_lwcond_attr_t idle_cond_attr = {.name = "JOBIDLE"};
+    ASSERT_ZERO(sysLwCondCreate(&pool->idle_cond, &pool->mutex, &idle_cond_attr), "Unable to create job pool condition");
+
+    // Allocate memory for the threads
+    pool->threads = (sys_ppu_thread_t *)malloc(sizeof(sys_ppu_thread_t) * thread_count);
+    ASSERT_NONZERO(pool->threads, "Unable to allocate memory for job pool threads");
+
+    for (int i = 0; i < thread_count; i++)
+    {
+        int ret = sysThreadCreate(&pool->threads[i], job_pool_worker, pool, 1000, stack_size, THREAD_JOINABLE, name);
+        if (ret != 0)
+        {
+            SDL_Log("Unable to create job pool thread %d: %d", i, ret);
+            break;
+        }
+
+        pool->thread_count++;
+    }
+
+    // A pool with no threads would never run anything
+    if (pool->thread_count == 0)
+        return -1;
+
+    return 0;
+}
+
+void job_pool_submit(job_pool_t *pool, job_func_t func, void *arg)
+{
+    job_t *job = (job_t *)malloc(sizeof(job_t));
+    ASSERT_NONZERO(job, "Unable to allocate memory for job");
+
+    job->func = func;
+    job->arg = arg;
+    job->next = NULL;
+
+    ASSERT_ZERO(sysLwMutexLock(&pool->mutex, 0), "Unable to lock job pool mutex");
+
+    // Add the job to the end of the queue
+    if (pool->tail != NULL)
+        pool->tail->next = job;
+    else
+        pool->head = job;
+    pool->tail = job;
+
+    ASSERT_ZERO(sysLwCondSignal(&pool->work_cond), "Unable to signal job pool condition");
+
+    ASSERT_ZERO(sysLwMutexUnlock(&pool->mutex), "Unable to unlock job pool mutex");
+}
+
+void job_pool_wait(job_pool_t *pool)
+{
+    ASSERT_ZERO(sysLwMutexLock(&pool->mutex, 0), "Unable to lock job pool mutex");
+
+    while (pool->head != NULL || pool->busy > 0)
+        ASSERT_ZERO(sysLwCondWait(&pool->idle_cond, 0), "Unable to wait on job pool condition");
+
+    ASSERT_ZERO(sysLwMutexUnlock(&pool->mutex), "Unable to unlock job pool mutex");
+}
+
+void job_pool_destroy(job_pool_t *pool)
+{
+    // Tell the workers to exit once the queue is drained
+    ASSERT_ZERO(sysLwMutexLock(&pool->mutex, 0), "Unable to lock job pool mutex");
+    pool->stopping = true;
+    ASSERT_ZERO(sysLwCondSignalAll(&pool->work_cond), "Unable to signal job pool condition");
+    ASSERT_ZERO(sysLwMutexUnlock(&pool->mutex), "Unable to unlock job pool mutex");
+
+    for (int i = 0; i < pool->thread_count; i++)
+    {
+        uint64_t ret;
+        sysThreadJoin(pool->threads[i], &ret);
+    }
+
+    free(pool->threads);
+
+    ASSERT_ZERO(sysLwCondDestroy(&pool->work_cond), "Unable to destroy job pool condition");
+    ASSERT_ZERO(sysLwCondDestroy(&pool->idle_cond), "Unable to destroy job pool condition");
+    ASSERT_ZERO(sysLwMutexDestroy(&pool->mutex), "Unable to destroy job pool mutex");
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdbool.h>
+#include <sys/thread.h>
+#include <sys/mutex.h>
+#include <sys/cond.h>
+
+typedef void (*job_func_t)(void *arg);
+
+typedef struct job_t
+{
+    struct job_t *next;
+    job_func_t func;
+    void *arg;
+} job_t;
+
+typedef struct job_pool_t
+{
+    sys_ppu_thread_t *threads;
+    int thread_count;
+    sys_lwmutex_t mutex;
+    // Signalled when a job is queued, or the pool is stopping
+    sys_lwcond_t work_cond;
+    // Signalled when the queue is empty and no jobs are running
+    sys_lwcond_t idle_cond;
+    job_t *head;
+    job_t *tail;
+    int busy;
+    bool stopping;
+} job_pool_t;
+
+int job_pool_create(job_pool_t *pool, int thread_count, uint64_t stack_size, char *name);
+void job_pool_submit(job_pool_t *pool, job_func_t func, void *arg);
+void job_pool_wait(job_pool_t *pool);
+void job_pool_destroy(job_pool_t *pool);
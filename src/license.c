@@ -1,96 +1,470 @@
 #include <SDL2/SDL.h>
 #include <dirent.h>
 #include <stdio.h>
+#include <unistd.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <cJSON.h>
 
-#include "paramsfo.h"
-#include "game_list.h"
 #include "assert.h"
+#include "types.h"
+#include "save_manager.h"
+#include "license.h"
 
 #define CONTENT_ID_LENGTH 0x30
 
-char *find_license(char *path, char *content_id)
+#define HOME_PATH "/dev_hdd0/home"
+#define LICENSE_INDEX_PATH GAME_DIR "licenses.json"
+
+// Must be a power of two
+#define LICENSE_BUCKET_COUNT 256
+
+#define JSON_HOME_MTIME_KEY "home_mtime"
+#define JSON_DIRECTORIES_KEY "directories"
+#define JSON_LICENSES_KEY "licenses"
+#define JSON_PATH_KEY "path"
+#define JSON_MTIME_KEY "mtime"
+#define JSON_CONTENT_ID_KEY "content_id"
+#define JSON_FILE_KEY "file"
+#define JSON_TYPE_KEY "type"
+
+typedef struct license_entry
+{
+    struct license_entry *next;
+    char content_id[CONTENT_ID_LENGTH + 1];
+    // The exdata directory the license is in, which is what scetool wants
+    char *directory;
+    char *file;
+    LICENSE_TYPE type;
+} license_entry;
+
+// An exdata directory, and its mtime when it was last read, since adding or removing a license changes it
+typedef struct license_directory
 {
-    DIR *directory = NULL;
-    directory = opendir(path);
-    ASSERT_NONZERO(directory, "Failed to open game directory");
+    struct license_directory *next;
+    char *path;
+    time_t mtime;
+} license_directory;
 
-    struct dirent *entry = NULL;
-    while ((entry = readdir(directory)) != NULL)
+static license_entry *license_buckets[LICENSE_BUCKET_COUNT] = {0};
+static license_directory *license_directories = NULL;
+static time_t home_mtime = 0;
+
+// Guards the tables above
+static sys_lwmutex_t license_mutex;
+// Held while the index is being brought up to date, so the background refresh and a patch never walk the disk at once
+static sys_lwmutex_t refresh_mutex;
+
+static sys_ppu_thread_t refresh_thread;
+static bool refresh_thread_started = false;
+
+static uint32_t hash_content_id(const char *content_id)
+{
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < CONTENT_ID_LENGTH && content_id[i] != '\0'; i++)
     {
-        char full_path[MAXPATHLEN + 2] = {0};
-        snprintf(full_path, MAXPATHLEN + 2, "%s/%s", path, entry->d_name);
+        hash ^= (uint8_t)content_id[i];
+        hash *= 16777619u;
+    }
+
+    return hash & (LICENSE_BUCKET_COUNT - 1);
+}
+
+static LICENSE_TYPE get_license_type(const char *file)
+{
+    const char *extension = strrchr(file, '.');
+    if (extension == NULL)
+        return LICENSE_TYPE_OTHER;
+
+    if (strcasecmp(extension, ".rap") == 0)
+        return LICENSE_TYPE_RAP;
+
+    if (strcasecmp(extension, ".rif") == 0)
+        return LICENSE_TYPE_RIF;
+
+    return LICENSE_TYPE_OTHER;
+}
 
-        if (entry->d_type == DT_REG)
+// Must be called with license_mutex held
+static void add_license(const char *content_id, const char *directory, const char *file, LICENSE_TYPE type)
+{
+    license_entry *entry = (license_entry *)malloc(sizeof(license_entry));
+    ASSERT_NONZERO(entry, "Unable to allocate memory for license entry");
+
+    memset(entry, 0, sizeof(license_entry));
+    strncpy(entry->content_id, content_id, CONTENT_ID_LENGTH);
+    entry->directory = strdup(directory);
+    entry->file = strdup(file);
+    entry->type = type;
+    ASSERT_NONZERO(entry->directory, "Unable to allocate memory for license directory");
+    ASSERT_NONZERO(entry->file, "Unable to allocate memory for license file");
+
+    uint32_t bucket = hash_content_id(content_id);
+    entry->next = license_buckets[bucket];
+    license_buckets[bucket] = entry;
+}
+
+// Must be called with license_mutex held
+static void remove_licenses_in(const char *directory)
+{
+    for (int i = 0; i < LICENSE_BUCKET_COUNT; i++)
+    {
+        license_entry **link = &license_buckets[i];
+        while (*link != NULL)
         {
-            // Skip over . and ..
-            if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0)
+            license_entry *entry = *link;
+
+            if (strcmp(entry->directory, directory) == 0)
             {
-                SDL_Log("%s / %s, cmp: %d", entry->d_name, content_id, memcmp(entry->d_name, content_id, CONTENT_ID_LENGTH));
+                (*link) = entry->next;
+
+                free(entry->directory);
+                free(entry->file);
+                free(entry);
+                continue;
+            }
+
+            link = &entry->next;
+        }
+    }
+}
+
+// Must be called with license_mutex held
+static license_directory *find_directory(const char *path)
+{
+    for (license_directory *directory = license_directories; directory != NULL; directory = directory->next)
+    {
+        if (strcmp(directory->path, path) == 0)
+            return directory;
+    }
 
-                // strlen(content_id) with limit of CONTENT_ID_LENGTH
-                int length = 0;
-                for (int i = 0; i < CONTENT_ID_LENGTH; i++)
+    return NULL;
+}
+
+// Must be called with license_mutex held
+static license_directory *add_directory(const char *path, time_t mtime)
+{
+    license_directory *directory = (license_directory *)malloc(sizeof(license_directory));
+    ASSERT_NONZERO(directory, "Unable to allocate memory for license directory");
+
+    directory->path = strdup(path);
+    ASSERT_NONZERO(directory->path, "Unable to allocate memory for license directory path");
+    directory->mtime = mtime;
+
+    directory->next = license_directories;
+    license_directories = directory;
+
+    return directory;
+}
+
+// Reads every license in an exdata directory, replacing what the index had for it
+static void index_directory(const char *path, time_t mtime)
+{
+    DIR *directory = opendir(path);
+
+    MUTEX_SCOPE(
+        &license_mutex,
+        {
+            remove_licenses_in(path);
+
+            license_directory *record = find_directory(path);
+            if (record == NULL)
+                record = add_directory(path, mtime);
+            record->mtime = mtime;
+
+            // A user without an exdata directory simply has no licenses
+            if (directory != NULL)
+            {
+                struct dirent *entry = NULL;
+                while ((entry = readdir(directory)) != NULL)
                 {
-                    if (content_id[i] == '\0')
-                        break;
+                    if (entry->d_type != DT_REG)
+                        continue;
+
+                    // License files are named after the content id they are for, up to the extension
+                    char content_id[CONTENT_ID_LENGTH + 1] = {0};
+                    size_t length = strcspn(entry->d_name, ".");
+                    if (length == 0 || length > CONTENT_ID_LENGTH)
+                        continue;
 
-                    length++;
+                    memcpy(content_id, entry->d_name, length);
+
+                    add_license(content_id, path, entry->d_name, get_license_type(entry->d_name));
                 }
+            }
+        });
 
-                if (memcmp(entry->d_name, content_id, length) == 0)
-                {
-                    SDL_Log("Found license: %s, full path: %s", entry->d_name, full_path);
+    if (directory != NULL)
+        closedir(directory);
+}
+
+static void save_license_index()
+{
+    cJSON *root = cJSON_CreateObject();
+    ASSERT_NONZERO(root, "Unable to create JSON object");
+
+    cJSON *directories = cJSON_CreateArray();
+    cJSON *licenses = cJSON_CreateArray();
 
-                    closedir(directory);
+    char *json_string = NULL;
+
+    MUTEX_SCOPE(
+        &license_mutex,
+        {
+            cJSON_AddItemToObject(root, JSON_HOME_MTIME_KEY, cJSON_CreateNumber(home_mtime));
+
+            for (license_directory *directory = license_directories; directory != NULL; directory = directory->next)
+            {
+                cJSON *json_directory = cJSON_CreateObject();
+                cJSON_AddItemToObject(json_directory, JSON_PATH_KEY, cJSON_CreateString(directory->path));
+                cJSON_AddItemToObject(json_directory, JSON_MTIME_KEY, cJSON_CreateNumber(directory->mtime));
+                cJSON_AddItemToArray(directories, json_directory);
+            }
 
-                    // Return the path to the license folder
-                    return strdup(path);
+            for (int i = 0; i < LICENSE_BUCKET_COUNT; i++)
+            {
+                for (license_entry *entry = license_buckets[i]; entry != NULL; entry = entry->next)
+                {
+                    cJSON *json_license = cJSON_CreateObject();
+                    cJSON_AddItemToObject(json_license, JSON_CONTENT_ID_KEY, cJSON_CreateString(entry->content_id));
+                    cJSON_AddItemToObject(json_license, JSON_PATH_KEY, cJSON_CreateString(entry->directory));
+                    cJSON_AddItemToObject(json_license, JSON_FILE_KEY, cJSON_CreateString(entry->file));
+                    cJSON_AddItemToObject(json_license, JSON_TYPE_KEY, cJSON_CreateNumber(entry->type));
+                    cJSON_AddItemToArray(licenses, json_license);
                 }
             }
-        }
+        });
+
+    cJSON_AddItemToObject(root, JSON_DIRECTORIES_KEY, directories);
+    cJSON_AddItemToObject(root, JSON_LICENSES_KEY, licenses);
+
+    json_string = cJSON_PrintUnformatted(root);
+    cJSON_Delete(root);
+    ASSERT_NONZERO(json_string, "Unable to convert JSON to string");
+
+    FILE *file = fopen(LICENSE_INDEX_PATH, "w");
+    if (file == NULL)
+    {
+        SDL_Log("Unable to open license index for writing");
+        cJSON_free(json_string);
+        return;
     }
 
-    closedir(directory);
+    fputs(json_string, file);
+    fclose(file);
 
-    return NULL;
+    cJSON_free(json_string);
 }
 
-char *find_license_from_all_users(char *content_id)
+static void read_license_index()
 {
-    char *path = "/dev_hdd0/home";
+    FILE *file = fopen(LICENSE_INDEX_PATH, "r");
+    if (file == NULL)
+        return;
+
+    // Get its length
+    fseek(file, 0, SEEK_END);
+    size_t file_size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    char *file_data = (char *)malloc(file_size);
+    ASSERT_NONZERO(file_data, "Unable to allocate memory for license index");
 
-    DIR *directory = NULL;
-    directory = opendir(path);
-    ASSERT_NONZERO(directory, "Failed to open game directory");
+    cJSON *root = NULL;
+    if (fread(file_data, sizeof(char), file_size, file) == file_size)
+        root = cJSON_ParseWithLength(file_data, file_size);
 
-    struct dirent *entry = NULL;
-    while ((entry = readdir(directory)) != NULL)
+    fclose(file);
+    free(file_data);
+
+    // A missing or broken index just means every directory gets read again
+    if (!cJSON_IsObject(root))
     {
-        char full_path[MAXPATHLEN + sizeof "/dev_hdd0/home" + 2] = {0};
-        snprintf(full_path, MAXPATHLEN + sizeof "/dev_hdd0/home" + 2, "%s/%s", path, entry->d_name);
+        cJSON_Delete(root);
+        return;
+    }
 
-        if (entry->d_type == DT_DIR)
+    MUTEX_SCOPE(
+        &license_mutex,
         {
-            // Skip over . and .. and non-9 character directories
-            if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0)
+            cJSON *json_home_mtime = cJSON_GetObjectItemCaseSensitive(root, JSON_HOME_MTIME_KEY);
+            if (cJSON_IsNumber(json_home_mtime))
+                home_mtime = (time_t)json_home_mtime->valuedouble;
+
+            cJSON *item = NULL;
+            cJSON_ArrayForEach(item, cJSON_GetObjectItemCaseSensitive(root, JSON_DIRECTORIES_KEY))
+            {
+                cJSON *path = cJSON_GetObjectItemCaseSensitive(item, JSON_PATH_KEY);
+                cJSON *mtime = cJSON_GetObjectItemCaseSensitive(item, JSON_MTIME_KEY);
+
+                if (cJSON_IsString(path) && cJSON_IsNumber(mtime) && find_directory(path->valuestring) == NULL)
+                    add_directory(path->valuestring, (time_t)mtime->valuedouble);
+            }
+
+            cJSON_ArrayForEach(item, cJSON_GetObjectItemCaseSensitive(root, JSON_LICENSES_KEY))
             {
-                char license_dir_path[MAXPATHLEN] = {0};
-                snprintf(license_dir_path, MAXPATHLEN, "%s/exdata", full_path);
+                cJSON *content_id = cJSON_GetObjectItemCaseSensitive(item, JSON_CONTENT_ID_KEY);
+                cJSON *path = cJSON_GetObjectItemCaseSensitive(item, JSON_PATH_KEY);
+                cJSON *license_file = cJSON_GetObjectItemCaseSensitive(item, JSON_FILE_KEY);
+                cJSON *type = cJSON_GetObjectItemCaseSensitive(item, JSON_TYPE_KEY);
+
+                if (cJSON_IsString(content_id) && cJSON_IsString(path) && cJSON_IsString(license_file) && cJSON_IsNumber(type))
+                    add_license(content_id->valuestring, path->valuestring, license_file->valuestring, (LICENSE_TYPE)type->valueint);
+            }
+        });
+
+    cJSON_Delete(root);
+}
+
+// Brings the index up to date with the disk, only reading the exdata directories whose mtime changed
+static void refresh_license_index()
+{
+    ASSERT_ZERO(sysLwMutexLock(&refresh_mutex, 0), "Unable to lock license refresh mutex");
+
+    bool changed = false;
+
+    struct stat home_stat;
+    if (stat(HOME_PATH, &home_stat) == 0 && home_stat.st_mtime != home_mtime)
+    {
+        home_mtime = home_stat.st_mtime;
+        changed = true;
+    }
+
+    // There are only ever a handful of users, so always list them, it is their exdata directories that are big
+    DIR *home = opendir(HOME_PATH);
+    if (home != NULL)
+    {
+        struct dirent *entry = NULL;
+        while ((entry = readdir(home)) != NULL)
+        {
+            if (entry->d_type != DT_DIR || strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+                continue;
 
-                char *license = find_license(license_dir_path, content_id);
-                if (license != NULL)
+            char license_dir_path[MAXPATHLEN] = {0};
+            snprintf(license_dir_path, MAXPATHLEN, "%s/%s/exdata", HOME_PATH, entry->d_name);
+
+            struct stat license_dir_stat;
+            time_t mtime = stat(license_dir_path, &license_dir_stat) == 0 ? license_dir_stat.st_mtime : 0;
+
+            bool stale = true;
+            MUTEX_SCOPE(
+                &license_mutex,
                 {
-                    closedir(directory);
+                    license_directory *directory = find_directory(license_dir_path);
+                    stale = directory == NULL || directory->mtime != mtime;
+                });
 
-                    return license;
-                }
+            if (stale)
+            {
+                SDL_Log("Indexing licenses in %s", license_dir_path);
+
+                index_directory(license_dir_path, mtime);
+                changed = true;
             }
         }
+
+        closedir(home);
     }
 
-    SDL_Log("Failed to find license for %s", content_id);
+    if (changed)
+        save_license_index();
 
-    closedir(directory);
+    ASSERT_ZERO(sysLwMutexUnlock(&refresh_mutex), "Unable to unlock license refresh mutex");
+}
 
-    return NULL;
-}
\ No newline at end of file
+static void license_index_thread(void *arg)
+{
+    refresh_license_index();
+
+    sysThreadExit(0);
+}
+
+void license_index_load()
+{
+    sys_lwmutex_attr_t mutex_attr = {
+        .name = "LICIDX",
+        .attr_protocol = SYS_LWMUTEX_PROTOCOL_FIFO,
+        .attr_recursive = SYS_LWMUTEX_ATTR_NOT_RECURSIVE,
+    };
+
+    ASSERT_ZERO(sysLwMutexCreate(&license_mutex, &mutex_attr), "Unable to create license index mutex");
+
+    sys_lwmutex_attr_t refresh_mutex_attr = {
+        .name = "LICREF",
+        .attr_protocol = SYS_LWMUTEX_PROTOCOL_FIFO,
+        .attr_recursive = SYS_LWMUTEX_ATTR_NOT_RECURSIVE,
+    };
+
+    ASSERT_ZERO(sysLwMutexCreate(&refresh_mutex, &refresh_mutex_attr), "Unable to create license refresh mutex");
+
+    read_license_index();
+
+    // Catch up with whatever changed since last time without holding up startup
+    if (sysThreadCreate(&refresh_thread, license_index_thread, NULL, 1000, 0x10000, THREAD_JOINABLE, "LICIDX") == 0)
+        refresh_thread_started = true;
+    else
+        SDL_Log("Unable to start license index thread, it will be refreshed when patching");
+}
+
+// Waits for the background refresh, so licenses.json is never left half written
+void license_index_shutdown()
+{
+    if (!refresh_thread_started)
+        return;
+
+    uint64_t ret;
+    sysThreadJoin(refresh_thread, &ret);
+
+    refresh_thread_started = false;
+}
+
+// Looks a content id up in the index, skipping licenses that are no longer where the index says they are
+static char *lookup_license(char *content_id)
+{
+    char *license_directory_path = NULL;
+
+    MUTEX_SCOPE(
+        &license_mutex,
+        {
+            for (license_entry *entry = license_buckets[hash_content_id(content_id)]; entry != NULL; entry = entry->next)
+            {
+                if (strncmp(entry->content_id, content_id, CONTENT_ID_LENGTH) != 0)
+                    continue;
+
+                char license_path[MAXPATHLEN] = {0};
+                snprintf(license_path, MAXPATHLEN, "%s/%s", entry->directory, entry->file);
+
+                if (access(license_path, F_OK) == 0)
+                {
+                    license_directory_path = strdup(entry->directory);
+                    break;
+                }
+            }
+        });
+
+    return license_directory_path;
+}
+
+char *find_license_from_all_users(char *content_id)
+{
+    char *license = lookup_license(content_id);
+
+    // Either the index is behind the disk, or there is no license, refreshing is cheap if nothing changed
+    if (license == NULL)
+    {
+        refresh_license_index();
+
+        license = lookup_license(content_id);
+    }
+
+    if (license == NULL)
+    {
+        SDL_Log("Failed to find license for %.*s", CONTENT_ID_LENGTH, content_id);
+        return NULL;
+    }
+
+    SDL_Log("Found license for %.*s in %s", CONTENT_ID_LENGTH, content_id, license);
+
+    return license;
+}
@@ -1 +1,14 @@
-char *find_license_from_all_users(char *content_id);
\ No newline at end of file
+#pragma once
+
+#include <stdint.h>
+
+typedef enum LICENSE_TYPE
+{
+    LICENSE_TYPE_OTHER = 0,
+    LICENSE_TYPE_RAP,
+    LICENSE_TYPE_RIF,
+} LICENSE_TYPE;
+
+void license_index_load();
+void license_index_shutdown();
+char *find_license_from_all_users(char *content_id);
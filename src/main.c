@@ -7,6 +7,7 @@
 #include <ppu-lv2.h>
 #include <unistd.h>
 #include <sysutil/sysutil.h>
+#include <sys/systime.h>
 
 #include "endian.h"
 #include "sdl2_picofont.h"
@@ -21,6 +22,11 @@
 #include "save_manager.h"
 #include "unicode.h"
 #include "osk.h"
+#include "slot_index.h"
+#include "self_info.h"
+#include "game_cache.h"
+#include "patch_record.h"
+#include "thumbnail.h"
 
 int handleControllerInput(state_t *state, bool *is_pad_connected)
 {
@@ -61,11 +67,21 @@ int handleControllerInput(state_t *state, bool *is_pad_connected)
             if (data.BTN_CIRCLE && !state->last_circle)
                 state->circle_pressed = true;
 
+            // If the user presses triangle, set the trianglePressed flag
+            if (data.BTN_TRIANGLE && !state->last_triangle)
+                state->triangle_pressed = true;
+
+            // If the user presses square, set the squarePressed flag
+            if (data.BTN_SQUARE && !state->last_square)
+                state->square_pressed = true;
+
             // Update our lastDown and lastUp variables
             state->last_down = data.BTN_DOWN;
             state->last_up = data.BTN_UP;
             state->last_cross = data.BTN_CROSS;
             state->last_circle = data.BTN_CIRCLE;
+            state->last_triangle = data.BTN_TRIANGLE;
+            state->last_square = data.BTN_SQUARE;
 
             // Clear the pad buffer
             ioPadClearBuf(0);
@@ -99,11 +115,21 @@ void switch_scene(state_t *state, STATE_SCENE scene)
     switch (scene)
     {
     case STATE_SCENE_SELECT_GAME:
-        state->wrap_count = state->game_count;
+        state->wrap_count = state->games.count;
+
+        // Nothing is being done with the game anymore, so the watcher is free to remove it
+        MUTEX_SCOPE(
+            state->games_mutex,
+            {
+                state->selected_game = NULL;
+            });
         break;
     case STATE_SCENE_SELECT_SERVER:
         // Plus one for the "manage servers" option
-        state->wrap_count = state->server_count + 1;
+        state->wrap_count = state->servers.count + 1;
+
+        // Look up how long of a URL fits, so servers that can't fit are marked before any work starts
+        state->url_capacity = slot_index_get_capacity(state->selected_game->title_id, state->selected_game->path);
         break;
     case STATE_SCENE_MANAGE_SERVERS:
 
@@ -113,8 +139,15 @@ void switch_scene(state_t *state, STATE_SCENE scene)
         state->patching_info.state = PATCHING_STATE_NOT_STARTED;
         state->patching_info.last_error = NULL;
 
+        // The last patch is long over by the time another one can be started, but its thread still has to be joined
+        if (state->patching_info.has_thread)
+        {
+            uint64_t patch_ret;
+            sysThreadJoin(*state->patching_info.thread, &patch_ret);
+        }
+
         // Create the thread
-        sysThreadCreate(state->patching_info.thread, patch_game, state, 1000, 0x10000, THREAD_JOINABLE, "PATCHING");
+        state->patching_info.has_thread = sysThreadCreate(state->patching_info.thread, patch_game, state, 1000, 0x10000, THREAD_JOINABLE, "PATCHING") == 0;
 
         break;
     case STATE_SCENE_DONE_PATCHING:
@@ -136,6 +169,163 @@ static void program_exit_callback()
     sysUtilUnregisterCallback(SYSUTIL_EVENT_SLOT0);
 }
 
+// Adds a game found by one of the scan threads to the list
+// The same game can be in more than one place, in which case the one from the most preferred source is kept
+static void add_game(game_list_entry *entry, void *arg)
+{
+    state_t *state = (state_t *)arg;
+
+    MUTEX_SCOPE(
+        state->games_mutex,
+        {
+            int existing_id = game_list_find_title_id(&state->games, entry->title_id);
+
+            if (existing_id < 0)
+            {
+                game_list_add(&state->games, entry);
+            }
+            // The game the user picked is left alone, since it may be being patched
+            else if (entry->source < game_list_get(&state->games, existing_id)->source && game_list_get(&state->games, existing_id) != state->selected_game)
+            {
+                game_list_replace(&state->games, existing_id, entry);
+            }
+            else
+            {
+                game_list_entry_destroy(entry);
+            }
+        });
+}
+
+// How often the game roots are checked for games being added or removed
+#define GAME_WATCH_INTERVAL_MS 2000
+#define GAME_WATCH_SLEEP_US 100000
+
+// Works out whether each game is stock, patched or updated since patching, which takes a couple of small reads per game
+static void probe_games(state_t *state)
+{
+    bool done = false;
+    for (int id = 0; running && !done; id++)
+    {
+        char *title_id = NULL;
+        char *path = NULL;
+
+        // Copy out what we need, so the list isn't locked while we read the disk
+        MUTEX_SCOPE(
+            state->games_mutex,
+            {
+                done = id >= state->games.id_count;
+
+                // Games we can't patch are shown as such without looking at them, and games we already know about are skipped
+                game_list_entry *entry = game_list_get(&state->games, id);
+                if (entry != NULL && entry->patchable && entry->status == PATCH_STATUS_UNKNOWN)
+                {
+                    title_id = strdup(entry->title_id);
+                    path = strdup(entry->path);
+                }
+            });
+
+        patch_record_t record;
+        if (path != NULL && patch_record_probe(title_id, path, &record) == 0)
+        {
+            bool updated = false;
+
+            MUTEX_SCOPE(
+                state->games_mutex,
+                {
+                    game_list_entry *entry = game_list_get(&state->games, id);
+
+                    // The patching thread says what the game it is working on is once it is done
+                    bool patching = entry == state->selected_game && state->patching_info.is_running;
+
+                    // The game may have been removed or replaced while we were looking at it
+                    if (entry != NULL && !patching && strcmp(entry->path, path) == 0)
+                    {
+                        free(entry->patched_server);
+                        entry->patched_server = record.has_server ? strdup(record.server_name) : NULL;
+                        entry->status = record.status;
+                        updated = true;
+                    }
+                });
+
+            if (updated)
+                game_cache_set_status(path, record.status, record.has_server ? record.server_name : NULL);
+        }
+
+        free(title_id);
+        free(path);
+    }
+
+    // Keep what we found, so the next launch only probes games that changed
+    game_cache_merge();
+}
+
+// Removes a game the watcher found was deleted
+static bool remove_game(char *path, void *arg)
+{
+    state_t *state = (state_t *)arg;
+    bool removed = true;
+
+    MUTEX_SCOPE(
+        state->games_mutex,
+        {
+            int id = game_list_find_path(&state->games, path);
+
+            // The game the user picked can't go away under them, the watcher tries again later
+            if (id >= 0 && game_list_get(&state->games, id) == state->selected_game)
+                removed = false;
+            else if (id >= 0)
+                game_list_remove(&state->games, id);
+        });
+
+    return removed;
+}
+
+static void scan_games(void *arg)
+{
+    state_t *state = (state_t *)arg;
+
+    // Iterate over the installed games, and get their info
+    if (iterate_games(add_game, state) != 0)
+        SDL_Log("Unable to iterate games");
+
+    MUTEX_SCOPE(
+        state->games_mutex,
+        {
+            state->scanning = false;
+        });
+
+    probe_games(state);
+
+    // Keep watching for games being installed or deleted while the app is open
+    uint32_t last_poll_ticks = SDL_GetTicks();
+    while (running)
+    {
+        // Sleep in short steps, so we notice the app closing quickly
+        sysUsleep(GAME_WATCH_SLEEP_US);
+
+        if (SDL_GetTicks() - last_poll_ticks < GAME_WATCH_INTERVAL_MS)
+            continue;
+
+        last_poll_ticks = SDL_GetTicks();
+
+        // Only new games need probing, the ones already in the list keep their status
+        if (poll_games(add_game, remove_game, state) > 0)
+            probe_games(state);
+        // Otherwise write out any status the patching thread changed
+        else
+            game_cache_merge();
+    }
+
+    sysThreadExit(0);
+}
+
+// How many games are drawn at once
+#define GAME_LIST_VISIBLE_COUNT 14
+// How many games either side of the visible ones get their icons loaded ahead of time
+#define GAME_LIST_PREFETCH_COUNT 4
+// Space between a game's icon and its name
+#define GAME_LIST_ICON_SPACING 6
+
 // a bit hacky but idc
 #define PATCHING_STATE_CASE(check_state)                                                 \
     if (state.patching_info.state == check_state)                                        \
@@ -149,10 +339,17 @@ static void program_exit_callback()
     font_print_to_renderer(font, display_name, &font_state);                             \
     font_state.y += FONT_CHAR_HEIGHT * font_state.h;
 
+// How many cancelled autodiscover requests can be left to stop on their own at once
+#define AUTODISCOVER_MAX_CANCELLED 8
+
 int main()
 {
     autodiscover_t autodiscover;
     ASSERT_ZERO(autodiscover_init(&autodiscover), "Unable to initialize autodiscover");
+    // The autodiscover request in flight, if there is one
+    autodiscover_job_t *autodiscover_job = NULL;
+    // Requests the user gave up on, each is freed once its thread has stopped, so the UI never waits on one
+    autodiscover_job_t *cancelled_autodiscover_jobs[AUTODISCOVER_MAX_CANCELLED] = {0};
 
     atexit(program_exit_callback);
 
@@ -184,6 +381,9 @@ int main()
     // Initialize the state of the app
     state_t state = {0};
 
+    // Patching fetches deltas through the same clients autodiscover uses
+    state.http_pool = &autodiscover.http_pool;
+
     char psid[16];
 
     // Get the IDPS and PSID
@@ -192,19 +392,58 @@ int main()
     SDL_Log("IDPS: %x%x%x%x%x%x%x%x%x%x%x%x%x%x%x%x", state.idps[0], state.idps[1], state.idps[2], state.idps[3], state.idps[4], state.idps[5], state.idps[6], state.idps[7], state.idps[8], state.idps[9], state.idps[10], state.idps[11], state.idps[12], state.idps[13], state.idps[14], state.idps[15]);
     SDL_Log("PSID: %x%x%x%x%x%x%x%x%x%x%x%x%x%x%x%x", psid[0], psid[1], psid[2], psid[3], psid[4], psid[5], psid[6], psid[7], psid[8], psid[9], psid[10], psid[11], psid[12], psid[13], psid[14], psid[15]);
 
-    // Iterate over the installed games, and get their info
-    ASSERT_ZERO(iterate_games("/dev_hdd0/game", &state.games, &state.game_count), "Unable to iterate games");
-
     // Create the default server entry of production refresh
-    state.servers = server_list_entry_create("Refresh", "http://refresh.jvyden.xyz:2095/lbp", true);
-    // Load the user's saved entries
-    state.servers->next = load_saved_servers();
-    // Count the number of servers
-    state.server_count = count_server_list_entries(state.servers);
+    server_list_init(&state.servers);
+    server_list_add(&state.servers, server_list_entry_create("Refresh", "http://refresh.jvyden.xyz:2095/lbp", true));
+    // Load the user's saved entries after it, this also makes sure our game dir exists
+    load_saved_servers(&state.servers);
+
+    // Start the thread which loads game icons as they are scrolled to, once the game dir is there to keep them in
+    thumbnail_init();
+
+    // Games are shown by title until the user picks another order
+    game_list_init(&state.games, GAME_SORT_TITLE);
+    state.highlighted_game_id = -1;
+
+    // Set up the SELF header cache, which the game scan fills
+    self_info_init();
+
+    // Load what we know about the games from last time, so only changed games need to be read
+    game_cache_load();
+
+    // Load the known URL slot capacities of each game
+    slot_index_load();
+
+    // Load the license index, and start bringing it up to date in the background
+    license_index_load();
+
+    // Load what each game was last patched to
+    patch_record_load();
+
+    sys_lwmutex_attr_t games_mutex_attr = {
+        .name = "GAMES",
+        .attr_protocol = SYS_LWMUTEX_PROTOCOL_FIFO,
+        .attr_recursive = SYS_LWMUTEX_ATTR_NOT_RECURSIVE,
+    };
+
+    // Allocate memory for the game list mutex
+    state.games_mutex = (sys_lwmutex_t *)malloc(sizeof(sys_lwmutex_t));
+    ASSERT_NONZERO(state.games_mutex, "Unable to allocate memory for mutex");
+
+    // Create the mutex
+    ASSERT_ZERO(sysLwMutexCreate(state.games_mutex, &games_mutex_attr), "Unable to create mutex");
+
+    // Allocate memory for the scan thread
+    state.scan_thread = (sys_ppu_thread_t *)malloc(sizeof(sys_ppu_thread_t));
+    ASSERT_NONZERO(state.scan_thread, "Unable to allocate memory for thread");
 
     // Set the initial state to game selection
     switch_scene(&state, STATE_SCENE_SELECT_GAME);
 
+    // Look for games in the background, so the list shows up straight away and fills in as they are found
+    state.scanning = true;
+    ASSERT_ZERO(sysThreadCreate(state.scan_thread, scan_games, &state, 1000, 0x10000, THREAD_JOINABLE, "SCANGAME"), "Unable to create scan thread");
+
     sys_lwmutex_attr_t mutex_attr = {
         .name = "PATCHING",
         .attr_protocol = SYS_LWMUTEX_PROTOCOL_FIFO,
@@ -242,6 +481,16 @@ int main()
             }
         }
 
+        // Clean up after cancelled autodiscover requests once they have noticed
+        for (int i = 0; i < AUTODISCOVER_MAX_CANCELLED; i++)
+        {
+            if (cancelled_autodiscover_jobs[i] != NULL && autodiscover_job_done(cancelled_autodiscover_jobs[i]))
+            {
+                autodiscover_job_free(cancelled_autodiscover_jobs[i]);
+                cancelled_autodiscover_jobs[i] = NULL;
+            }
+        }
+
         // Clear the screen to black
         SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
         SDL_RenderClear(renderer);
@@ -279,11 +528,86 @@ int main()
         {
         case STATE_SCENE_SELECT_GAME:
         {
+            // If we are typing in a search
+            if (state.input_state == INPUT_STATE_SEARCH)
+            {
+                // If the OSK has closed
+                if (!is_osk_running())
+                {
+                    // Get the text from the OSK, if its null the user cancelled
+                    char *prefix = get_utf8_output();
+
+                    if (prefix != NULL)
+                    {
+                        // Jump to the first game starting with what they typed
+                        MUTEX_SCOPE(
+                            state.games_mutex,
+                            {
+                                int index = game_list_find_prefix(&state.games, prefix);
+                                if (index >= 0)
+                                    state.selection = index;
+                            });
+                    }
+
+                    state.input_state = INPUT_STATE_NONE;
+
+                    break;
+                }
+
+                font_print_to_renderer(font, "Waiting for search...", &font_state);
+                font_state.y += FONT_CHAR_HEIGHT * font_state.h;
+                break;
+            }
+
+            ASSERT_ZERO(sysLwMutexLock(state.games_mutex, 0), "Unable to lock mutex");
+
+            // If the user presses triangle, show the games in the next order
+            if (state.triangle_pressed)
+                game_list_set_sort(&state.games, (state.games.sort + 1) % GAME_SORT_COUNT);
+
+            // Games can be added or moved around while the list is shown, so keep the selection on the same game
+            if (state.games_version != state.games.version)
+            {
+                int index = game_list_view_index(&state.games, state.highlighted_game_id);
+                if (index >= 0)
+                    state.selection = index;
+
+                state.games_version = state.games.version;
+            }
+
+            // The highlighted game may have been deleted, so keep the selection inside the list
+            if (state.selection >= state.games.count)
+                state.selection = state.games.count > 0 ? state.games.count - 1 : 0;
+
+            state.wrap_count = state.games.count;
+
+            game_list_entry *highlighted = game_list_get_view(&state.games, state.selection);
+            state.highlighted_game_id = highlighted != NULL ? highlighted->id : -1;
+
+            char header[256] = {0};
+            snprintf(header, 256, "Sorted by %s (triangle to change, square to search)%s", get_game_sort_name(state.games.sort), state.scanning ? " - Scanning for games..." : "");
+            font_print_to_renderer(font, header, &font_state);
+            font_state.y += FONT_CHAR_HEIGHT * font_state.h * 2;
+
+            // Only draw the games around the selection, so big libraries don't draw hundreds of lines off screen
+            int first = state.selection - GAME_LIST_VISIBLE_COUNT / 2;
+            if (first > state.games.count - GAME_LIST_VISIBLE_COUNT)
+                first = state.games.count - GAME_LIST_VISIBLE_COUNT;
+            if (first < 0)
+                first = 0;
+
+            // Start loading the icons just off screen, so they are ready by the time they are scrolled to
+            for (int i = first - GAME_LIST_PREFETCH_COUNT; i < first + GAME_LIST_VISIBLE_COUNT + GAME_LIST_PREFETCH_COUNT; i++)
+            {
+                if ((i < first || i >= first + GAME_LIST_VISIBLE_COUNT) && i >= 0 && i < state.games.count)
+                    thumbnail_prefetch(game_list_get_view(&state.games, i)->path);
+            }
+
             // Draw the game list
-            game_list_entry *entry = state.games;
-            int i = 0;
-            while (entry != NULL)
+            for (int i = first; i < state.games.count && i < first + GAME_LIST_VISIBLE_COUNT; i++)
             {
+                game_list_entry *entry = game_list_get_view(&state.games, i);
+
                 // If the user presses cross on the selected game, switch to the server selection scene
                 if (state.selection == i && state.cross_pressed)
                 {
@@ -293,18 +617,49 @@ int main()
 
                 char display_name[256] = {0};
 
+                // Describe the game's executable, as read from its header
+                char *self_type = "Unknown";
+                if (entry->self_type == SELF_TYPE_NPDRM)
+                    self_type = "NPDRM";
+                else if (entry->self_type == SELF_TYPE_APP)
+                    self_type = "Disc";
+
+                // Describe what the EBOOT.BIN is now, once the probe has looked at it
+                char status[128] = {0};
+                if (!entry->patchable)
+                    snprintf(status, 128, " [%s]", get_patch_status_name(PATCH_STATUS_UNPATCHABLE));
+                else if (entry->status == PATCH_STATUS_PATCHED && entry->patched_server != NULL)
+                    snprintf(status, 128, " [Patched to %s]", entry->patched_server);
+                else if (entry->status != PATCH_STATUS_UNKNOWN)
+                    snprintf(status, 128, " [%s]", get_patch_status_name(entry->status));
+
                 // Make a pretty display name
-                snprintf(display_name, 256, "%s%s (%s) [%s]", i == state.selection ? ">>> " : "", entry->title, entry->title_id, entry->path);
+                snprintf(display_name, 256, "%s%s (%s) [%s] [%s] [%s]%s", i == state.selection ? ">>> " : "", entry->title, entry->title_id, get_game_source_name(entry->source), entry->path, self_type, status);
 
-                // Draw the display name
-                font_print_to_renderer(font, display_name, &font_state);
-                // Move the text down by the height of the text
-                font_state.y += FONT_CHAR_HEIGHT * font_state.h;
+                // Draw the icon, if it has been loaded yet
+                SDL_Texture *thumbnail = thumbnail_get(renderer, entry->path);
+                if (thumbnail != NULL)
+                {
+                    SDL_Rect thumbnail_rect = {.x = font_state.x, .y = font_state.y, .w = THUMBNAIL_WIDTH, .h = THUMBNAIL_HEIGHT};
+                    SDL_RenderCopy(renderer, thumbnail, NULL, &thumbnail_rect);
+                }
+
+                // Draw the display name next to the icon, centered on it
+                SDL_Rect name_state = font_state;
+                name_state.x += THUMBNAIL_WIDTH + GAME_LIST_ICON_SPACING;
+                name_state.y += (THUMBNAIL_HEIGHT - FONT_CHAR_HEIGHT * font_state.h) / 2;
+                font_print_to_renderer(font, display_name, &name_state);
+                // Move the text down by the height of the icon
+                font_state.y += THUMBNAIL_HEIGHT;
+            }
 
-                // Move to the next item in the list
-                entry = entry->next;
+            ASSERT_ZERO(sysLwMutexUnlock(state.games_mutex), "Unable to unlock mutex");
 
-                i++;
+            // If the user presses square, let them type the start of a title to jump to
+            if (state.square_pressed && state.scene == STATE_SCENE_SELECT_GAME)
+            {
+                osk_open(u"Search games", u"");
+                state.input_state = INPUT_STATE_SEARCH;
             }
 
             break;
@@ -324,20 +679,30 @@ int main()
                 switch_scene(&state, STATE_SCENE_SELECT_GAME);
             }
 
-            if (state.cross_pressed && state.selection == state.server_count)
+            if (state.cross_pressed && state.selection == state.servers.count)
             {
                 switch_scene(&state, STATE_SCENE_MANAGE_SERVERS);
                 break;
             }
 
             // Draw the server list
-            server_list_entry *entry = state.servers;
-            int i = 0;
-            while (entry != NULL)
+            for (int i = 0; i < state.servers.count; i++)
             {
+                server_list_entry *entry = state.servers.entries[i];
+
+                // Whether we already know this server's URL won't fit in the game
+                bool too_long = state.url_capacity >= 0 && strlen(entry->url) > state.url_capacity;
+
                 // If the user presses cross on the selected game, switch to the patching progress scene
                 if (state.selection == i && state.cross_pressed)
                 {
+                    if (too_long)
+                    {
+                        state.last_error = "URL too long to fit in EBOOT.";
+                        switch_scene(&state, STATE_SCENE_ERROR);
+                        break;
+                    }
+
                     state.selected_server = entry;
                     switch_scene(&state, STATE_SCENE_PATCHING);
                 }
@@ -345,23 +710,18 @@ int main()
                 char display_name[256] = {0};
 
                 // Make a pretty display name
-                snprintf(display_name, 256, "%s%s (%s)", i == state.selection ? ">>> " : "", entry->name, entry->url);
+                snprintf(display_name, 256, "%s%s (%s)%s", i == state.selection ? ">>> " : "", entry->name, entry->url, too_long ? " [URL too long]" : "");
 
                 // Draw the display name
                 font_print_to_renderer(font, display_name, &font_state);
                 // Move the text down by the height of the text
                 font_state.y += FONT_CHAR_HEIGHT * font_state.h;
-
-                // Move to the next item in the list
-                entry = entry->next;
-
-                i++;
             }
 
             font_state.y += FONT_CHAR_HEIGHT * font_state.h;
             font_print_to_renderer(
                 font,
-                state.selection == state.server_count ? ">>> Manage Servers" : "Manage Servers",
+                state.selection == state.servers.count ? ">>> Manage Servers" : "Manage Servers",
                 &font_state);
             font_state.y += FONT_CHAR_HEIGHT * font_state.h;
 
@@ -369,7 +729,7 @@ int main()
         }
         case STATE_SCENE_MANAGE_SERVERS:
         {
-            state.wrap_count = state.server_count + 1;
+            state.wrap_count = state.servers.count + 1;
 
             if (state.input_state == INPUT_STATE_AUTODISCOVER_URL)
             {
@@ -384,56 +744,97 @@ int main()
                         break;
                     }
 
-                    char *server_brand;
-                    char *patch_url;
-                    bool patch_digest;
-                    if (autodiscover_execute(&autodiscover, autodiscover_url, &server_brand, &patch_url, &patch_digest) != 0)
+                    // Contact the server in the background, so we keep drawing while we wait on it
+                    autodiscover_job = autodiscover_start(&autodiscover, autodiscover_url);
+                    if (autodiscover_job == NULL)
                     {
-                        SDL_Log("Unable to execute autodiscover");
-                        state.last_error = "Unable to execute autodiscover";
+                        state.input_state = INPUT_STATE_NONE;
+
+                        SDL_Log("Unable to start autodiscover");
+                        state.last_error = "Unable to start autodiscover";
                         switch_scene(&state, STATE_SCENE_ERROR);
                         break;
                     }
 
-                    server_list_entry *new_entry = server_list_entry_create(server_brand, patch_url, patch_digest);
+                    state.input_state = INPUT_STATE_CONTACTING_SERVER;
 
-                    server_list_entry *entry = state.servers;
-                    while (true)
-                    {
-                        if (entry->next == NULL)
-                        {
-                            entry->next = new_entry;
-                            break;
-                        }
+                    break;
+                }
 
-                        entry = entry->next;
-                    }
+                font_print_to_renderer(
+                    font,
+                    "Waiting for Autodiscover URL...",
+                    &font_state);
+                font_state.y += FONT_CHAR_HEIGHT * font_state.h;
+                break;
+            }
 
-                    state.server_count = count_server_list_entries(state.servers);
+            // If we are waiting on the autodiscover request
+            if (state.input_state == INPUT_STATE_CONTACTING_SERVER)
+            {
+                // If the user presses circle, stop waiting, the request is freed once it has stopped
+                // Only allowed while there is room to keep it, otherwise it is still waited on like before
+                int free_slot = -1;
+                for (int i = 0; i < AUTODISCOVER_MAX_CANCELLED && free_slot < 0; i++)
+                {
+                    if (cancelled_autodiscover_jobs[i] == NULL)
+                        free_slot = i;
+                }
 
-                    free(server_brand);
-                    free(patch_url);
+                if (state.circle_pressed && free_slot >= 0)
+                {
+                    autodiscover_job_cancel(autodiscover_job);
+                    cancelled_autodiscover_jobs[free_slot] = autodiscover_job;
+                    autodiscover_job = NULL;
 
                     state.input_state = INPUT_STATE_NONE;
 
+                    break;
+                }
+
+                if (autodiscover_job_done(autodiscover_job))
+                {
+                    int result = autodiscover_job->result;
+
+                    if (result == 0)
+                        server_list_add(&state.servers, server_list_entry_create(autodiscover_job->server_brand, autodiscover_job->patch_url, autodiscover_job->patch_digest));
+
+                    autodiscover_job_free(autodiscover_job);
+                    autodiscover_job = NULL;
+
+                    state.input_state = INPUT_STATE_NONE;
+
+                    if (result != 0)
+                    {
+                        SDL_Log("Unable to execute autodiscover");
+                        state.last_error = "Unable to execute autodiscover";
+                        switch_scene(&state, STATE_SCENE_ERROR);
+                        break;
+                    }
+
                     // Save the new list
-                    if (save_servers(state.servers->next) != 0)
+                    if (save_servers(state.servers.entries + 1, state.servers.count - 1) != 0)
                     {
                         // If it fails, switch to the error scene
                         SDL_Log("Unable to save servers");
                         state.last_error = "Unable to save servers";
                         switch_scene(&state, STATE_SCENE_ERROR);
 
+                        free(state.input_name);
+
                         break;
                     }
 
                     break;
                 }
 
-                font_print_to_renderer(
-                    font,
-                    "Waiting for Autodiscover URL...",
-                    &font_state);
+                // Animate the dots, so it is clear we haven't locked up
+                char contacting[64] = {0};
+                snprintf(contacting, 64, "Contacting server%.*s", (int)(SDL_GetTicks() / 500 % 4), "...");
+                font_print_to_renderer(font, contacting, &font_state);
+                font_state.y += FONT_CHAR_HEIGHT * font_state.h;
+
+                font_print_to_renderer(font, "Press O to cancel.", &font_state);
                 font_state.y += FONT_CHAR_HEIGHT * font_state.h;
                 break;
             }
@@ -493,36 +894,22 @@ int main()
                         break;
                     }
 
-                    // Create a new entry
-                    server_list_entry *new_entry = server_list_entry_create(state.input_name, patch_url, false);
-
-                    // Add it to the end of the list
-                    server_list_entry *entry = state.servers;
-                    while (true)
-                    {
-                        if (entry->next == NULL)
-                        {
-                            entry->next = new_entry;
-                            break;
-                        }
-
-                        entry = entry->next;
-                    }
-
-                    // Update the server count
-                    state.server_count = count_server_list_entries(state.servers);
+                    // Create a new entry, and add it to the end of the list
+                    server_list_add(&state.servers, server_list_entry_create(state.input_name, patch_url, false));
 
                     // Reset the input state
                     state.input_state = INPUT_STATE_NONE;
 
                     // Save the new list
-                    if (save_servers(state.servers->next) != 0)
+                    if (save_servers(state.servers.entries + 1, state.servers.count - 1) != 0)
                     {
                         // If it fails, switch to the error scene
                         SDL_Log("Unable to save servers");
                         state.last_error = "Unable to save servers";
                         switch_scene(&state, STATE_SCENE_ERROR);
 
+                        free(state.input_name);
+
                         break;
                     }
 
@@ -550,7 +937,7 @@ int main()
             font_print_to_renderer(font, "Select a server to delete it.", &font_state);
             font_state.y += FONT_CHAR_HEIGHT * font_state.h * 2;
 
-            state.wrap_count = state.server_count + 2;
+            state.wrap_count = state.servers.count + 2;
 
             // Force state.selection to not be on the default server.
             if (state.selection == 0)
@@ -560,39 +947,28 @@ int main()
             bool deleted = false;
 
             // Draw the server list
-            server_list_entry *last_entry = NULL;
-            server_list_entry *entry = state.servers;
-            int i = 0;
-            while (entry != NULL)
+            for (int i = 0; i < state.servers.count; i++)
             {
+                server_list_entry *entry = state.servers.entries[i];
+
                 // If the user presses cross on the selected game, delete that game
                 if (state.selection > 0 && state.selection == i && state.cross_pressed)
                 {
-                    // Remove the entry from the list
-                    if (last_entry == NULL)
-                    {
-                        state.servers = entry->next;
-                    }
-                    else
-                    {
-                        last_entry->next = entry->next;
-                    }
-
-                    state.server_count = count_server_list_entries(state.servers);
-
-                    // Free the memory
-                    server_list_entry_destroy(entry);
+                    // Remove the entry from the list, and free the memory
+                    server_list_remove(&state.servers, i);
 
                     deleted = true;
 
                     // Save the new list
-                    if (save_servers(state.servers->next) != 0)
+                    if (save_servers(state.servers.entries + 1, state.servers.count - 1) != 0)
                     {
                         // If it fails, switch to the error scene
                         SDL_Log("Unable to save servers");
                         state.last_error = "Unable to save servers";
                         switch_scene(&state, STATE_SCENE_ERROR);
 
+                        free(state.input_name);
+
                         break;
                     }
 
@@ -608,23 +984,16 @@ int main()
                 font_print_to_renderer(font, display_name, &font_state);
                 // Move the text down by the height of the text
                 font_state.y += FONT_CHAR_HEIGHT * font_state.h;
-
-                last_entry = entry;
-
-                // Move to the next item in the list
-                entry = entry->next;
-
-                i++;
             }
 
             font_state.y += FONT_CHAR_HEIGHT * font_state.h;
             font_print_to_renderer(
                 font,
-                state.selection == state.server_count ? ">>> Create new server using Autodiscover" : "Create new server using Autodiscover",
+                state.selection == state.servers.count ? ">>> Create new server using Autodiscover" : "Create new server using Autodiscover",
                 &font_state);
             font_state.y += FONT_CHAR_HEIGHT * font_state.h;
 
-            if (!deleted && state.selection == state.server_count && state.cross_pressed)
+            if (!deleted && state.selection == state.servers.count && state.cross_pressed)
             {
                 osk_open(u"Enter URL for Autodiscover", u"http://refresh.jvyden.xyz:2095/");
                 state.input_state = INPUT_STATE_AUTODISCOVER_URL;
@@ -632,11 +1001,11 @@ int main()
 
             font_print_to_renderer(
                 font,
-                state.selection == state.server_count + 1 ? ">>> Create new server manually" : "Create new server manually",
+                state.selection == state.servers.count + 1 ? ">>> Create new server manually" : "Create new server manually",
                 &font_state);
             font_state.y += FONT_CHAR_HEIGHT * font_state.h;
 
-            if (!deleted && state.selection == state.server_count + 1 && state.cross_pressed)
+            if (!deleted && state.selection == state.servers.count + 1 && state.cross_pressed)
             {
                 osk_open(u"Enter name for server", u"");
                 state.input_state = INPUT_STATE_NAME;
@@ -658,6 +1027,14 @@ int main()
                             PATCHING_STATE_CASE(PATCHING_STATE_ENCRYPTING);
                             PATCHING_STATE_CASE(PATCHING_STATE_DONE);
 
+                            if (state.patching_info.modules_total > 1)
+                            {
+                                font_state.y += FONT_CHAR_HEIGHT * font_state.h;
+                                snprintf(display_name, 256, "Executables: %d/%d", state.patching_info.modules_done, state.patching_info.modules_total);
+                                font_print_to_renderer(font, display_name, &font_state);
+                                font_state.y += FONT_CHAR_HEIGHT * font_state.h;
+                            }
+
                             if (state.patching_info.state == PATCHING_STATE_ERROR)
                             {
                                 switch_scene(&state, STATE_SCENE_ERROR);
@@ -746,6 +1123,8 @@ int main()
         // Reset the crossPressed and circlePressed flags, since they are single press
         state.cross_pressed = false;
         state.circle_pressed = false;
+        state.triangle_pressed = false;
+        state.square_pressed = false;
 
         SDL_RenderPresent(renderer);
     }
@@ -756,8 +1135,42 @@ int main()
         return 1;
     }
 
+    // Nobody is going to read the result of a request still in flight, but it has to stop before autodiscover goes away
+    if (autodiscover_job != NULL)
+    {
+        autodiscover_job_cancel(autodiscover_job);
+        autodiscover_job_free(autodiscover_job);
+    }
+
+    // The app is going away, so waiting on requests which are still stopping is all that is left to do
+    for (int i = 0; i < AUTODISCOVER_MAX_CANCELLED; i++)
+    {
+        if (cancelled_autodiscover_jobs[i] != NULL)
+            autodiscover_job_free(cancelled_autodiscover_jobs[i]);
+    }
+
+    // Wait for the scan to stop touching the game list
+    uint64_t scan_ret;
+    sysThreadJoin(*state.scan_thread, &scan_ret);
+
+    // A patch still running has to finish, it can't be left half committed and it uses the HTTP pool
+    if (state.patching_info.has_thread)
+    {
+        uint64_t patch_ret;
+        sysThreadJoin(*state.patching_info.thread, &patch_ret);
+    }
+
+    // The license index may still be being written out
+    license_index_shutdown();
+
+    ASSERT_ZERO(sysLwMutexDestroy(state.games_mutex), "Unable to destroy mutex");
     ASSERT_ZERO(sysLwMutexDestroy(state.patching_info.mutex), "Unable to destroy mutex");
 
+    // Stop loading icons, and free the textures while the renderer is still around
+    thumbnail_shutdown();
+
+    autodiscover_deinit(&autodiscover);
+
     font_exit(font);
     SDL_Quit();
 
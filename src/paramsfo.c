@@ -4,6 +4,7 @@
 #include <stdio.h>
 #include "endian.h"
 #include "assert.h"
+#include "paramsfo.h"
 
 // https://psdevwiki.com/ps3/PARAM.SFO#Internal_Structure
 struct sfo_header
@@ -24,13 +25,63 @@ struct sfo_index_table_entry
     uint32_t data_offset;  /** param_data offset (relative to start offset of data_table) */
 };
 
-char *get_title(char *path)
+// Copies a string value out of the data table, making sure it stays inside the file and is terminated
+// Returns false if the value is not inside the file, in which case out is left alone
+static bool copy_value(char *out, size_t out_length, const uint8_t *data, size_t size, uint64_t offset, uint32_t length)
 {
+    if (offset > size || length > size - offset)
+        return false;
+
+    size_t copy_length = strnlen((const char *)data + offset, length);
+    if (copy_length > out_length - 1)
+        copy_length = out_length - 1;
+
+    memcpy(out, data + offset, copy_length);
+    out[copy_length] = '\0';
+
+    return true;
+}
+
+int read_sfo(char *path, sfo_info_t *info)
+{
+    memset(info, 0, sizeof(sfo_info_t));
+
     FILE *file = fopen(path, "rb");
-    ASSERT_NONZERO(file, "Unable to open file");
+    if (file == NULL)
+    {
+        SDL_Log("Unable to open %s", path);
+        return -1;
+    }
+
+    // Get its length
+    fseek(file, 0, SEEK_END);
+    long file_size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    if (file_size < (long)sizeof(struct sfo_header) || file_size > SFO_MAX_SIZE)
+    {
+        SDL_Log("Invalid SFO size: %ld", file_size);
+        fclose(file);
+        return -1;
+    }
+
+    // Read the whole file in one go, and parse it from memory
+    size_t size = file_size;
+    uint8_t *data = (uint8_t *)malloc(size);
+    ASSERT_NONZERO(data, "Unable to allocate memory for SFO");
+
+    size_t read = fread(data, 1, size, file);
+    fclose(file);
+
+    if (read != size)
+    {
+        SDL_Log("Unable to read %s", path);
+        free(data);
+        return -1;
+    }
 
     struct sfo_header header = {0};
-    fread(&header, sizeof(struct sfo_header), 1, file);
+    memcpy(&header, data, sizeof(struct sfo_header));
 
     // byteswap since file is LE and we're on BE
     header.magic = _ES32(header.magic);
@@ -43,15 +94,24 @@ char *get_title(char *path)
     if (header.magic != _ES32(*((uint32_t *)"\0PSF")))
     {
         SDL_Log("Invalid magic: %x", header.magic);
-        return NULL;
+        free(data);
+        return -1;
     }
 
-    for (int i = 0; i < header.tables_entries; i++)
+    // Make sure the index table and both table starts are inside the file
+    if (header.tables_entries > (size - sizeof(struct sfo_header)) / sizeof(struct sfo_index_table_entry) ||
+        header.key_table_start > size ||
+        header.data_table_start > size)
     {
-        struct sfo_index_table_entry entry = {0};
-        fread(&entry, sizeof(struct sfo_index_table_entry), 1, file);
+        SDL_Log("Invalid SFO tables in %s", path);
+        free(data);
+        return -1;
+    }
 
-        long old_position = ftell(file);
+    for (uint32_t i = 0; i < header.tables_entries; i++)
+    {
+        struct sfo_index_table_entry entry = {0};
+        memcpy(&entry, data + sizeof(struct sfo_header) + i * sizeof(struct sfo_index_table_entry), sizeof(struct sfo_index_table_entry));
 
         // byteswap since file is LE and we're on BE
         entry.key_offset = _ES16(entry.key_offset);
@@ -60,30 +120,47 @@ char *get_title(char *path)
         entry.data_max_len = _ES32(entry.data_max_len);
         entry.data_offset = _ES32(entry.data_offset);
 
-        // Read key
-        char key[256] = {0};
-        fseek(file, header.key_table_start + entry.key_offset, SEEK_SET);
-        fread(key, 256, 1, file);
+        // Skip over keys which point outside the file
+        size_t key_offset = (size_t)header.key_table_start + entry.key_offset;
+        if (key_offset >= size)
+            continue;
 
-        // Read value
-        char value[256] = {0};
-        fseek(file, header.data_table_start + entry.data_offset, SEEK_SET);
-        fread(value, 256, 1, file);
+        const char *key = (const char *)data + key_offset;
+        size_t key_length = strnlen(key, size - key_offset);
+        if (key_offset + key_length >= size)
+            continue;
 
-        // SDL_Log("%s: %s", key, value);
+        // Added in 64 bits, so a huge data offset can't wrap around back into the file
+        uint64_t data_offset = (uint64_t)header.data_table_start + entry.data_offset;
 
         if (strcmp(key, "TITLE") == 0)
-        {
-            fclose(file);
-            return strdup(value);
-        }
-
-        fseek(file, old_position, SEEK_SET);
+            info->has_title = copy_value(info->title, SFO_TITLE_LENGTH, data, size, data_offset, entry.data_len);
+        else if (strcmp(key, "TITLE_ID") == 0)
+            copy_value(info->title_id, SFO_TITLE_ID_LENGTH, data, size, data_offset, entry.data_len);
+        else if (strcmp(key, "APP_VER") == 0)
+            copy_value(info->app_ver, SFO_APP_VER_LENGTH, data, size, data_offset, entry.data_len);
+        else if (strcmp(key, "CATEGORY") == 0)
+            copy_value(info->category, SFO_CATEGORY_LENGTH, data, size, data_offset, entry.data_len);
+        else if (strcmp(key, "VERSION") == 0)
+            copy_value(info->version, SFO_VERSION_LENGTH, data, size, data_offset, entry.data_len);
     }
 
-    SDL_Log("Unable to find TITLE");
+    free(data);
 
-    fclose(file);
+    return 0;
+}
+
+char *get_title(char *path)
+{
+    sfo_info_t info;
+    if (read_sfo(path, &info) != 0)
+        return NULL;
+
+    if (!info.has_title)
+    {
+        SDL_Log("Unable to find TITLE");
+        return NULL;
+    }
 
-    return NULL;
-}
\ No newline at end of file
+    return strdup(info.title);
+}
@@ -1 +1,27 @@
-char *get_title(char *path);
\ No newline at end of file
+#pragma once
+
+#include <stdbool.h>
+
+// Largest PARAM.SFO we will read, real ones are a couple of KB
+#define SFO_MAX_SIZE 0x10000
+
+// https://psdevwiki.com/ps3/PARAM.SFO#Parameters, plus one for the terminator
+#define SFO_TITLE_LENGTH (128 + 1)
+#define SFO_TITLE_ID_LENGTH (16 + 1)
+#define SFO_APP_VER_LENGTH (8 + 1)
+#define SFO_CATEGORY_LENGTH (4 + 1)
+#define SFO_VERSION_LENGTH (8 + 1)
+
+// The fields we care about, all of which are strings, left empty when the SFO doesn't have them
+typedef struct sfo_info_t
+{
+    char title[SFO_TITLE_LENGTH];
+    char title_id[SFO_TITLE_ID_LENGTH];
+    char app_ver[SFO_APP_VER_LENGTH];
+    char category[SFO_CATEGORY_LENGTH];
+    char version[SFO_VERSION_LENGTH];
+    bool has_title;
+} sfo_info_t;
+
+int read_sfo(char *path, sfo_info_t *info);
+char *get_title(char *path);
@@ -0,0 +1,415 @@
+#include <SDL2/SDL.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <cJSON.h>
+
+#include "assert.h"
+#include "types.h"
+#include "save_manager.h"
+#include "self_header.h"
+#include "self_info.h"
+#include "paramsfo.h"
+#include "patch_record.h"
+
+#define PATCH_RECORD_PATH GAME_DIR "patch_records.json"
+
+#define JSON_TITLE_ID_KEY "title_id"
+#define JSON_SERVER_NAME_KEY "server_name"
+#define JSON_SERVER_URL_KEY "server_url"
+#define JSON_PATCH_DIGEST_KEY "patch_digest"
+#define JSON_APP_VER_KEY "app_ver"
+#define JSON_MODULES_KEY "modules"
+#define JSON_NAME_KEY "name"
+#define JSON_PATCHED_KEY "patched"
+#define JSON_BACKUP_KEY "backup"
+#define JSON_APP_VERSION_KEY "app_version"
+#define JSON_SIZE_KEY "size"
+#define JSON_MTIME_KEY "mtime"
+#define JSON_HEADER_CRC_KEY "header_crc"
+
+// Enough to tell two executables apart without reading all of them
+typedef struct file_fingerprint_t
+{
+    uint64_t size;
+    uint64_t mtime;
+    // The SELF header holds the encrypted keys, so it changes whenever the executable is re-encrypted
+    uint32_t header_crc;
+} file_fingerprint_t;
+
+// What every game was last patched to, read by the probe thread and written by the patching thread
+static cJSON *patch_records = NULL;
+static sys_lwmutex_t patch_records_mutex;
+
+static int fingerprint_file(const char *path, file_fingerprint_t *fingerprint)
+{
+    struct stat file_stat;
+    if (stat(path, &file_stat) != 0)
+        return -1;
+
+    fingerprint->size = file_stat.st_size;
+    fingerprint->mtime = file_stat.st_mtime;
+
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+        return -1;
+
+    uint8_t *header = (uint8_t *)malloc(SELF_HEADER_READ_SIZE);
+    ASSERT_NONZERO(header, "Unable to allocate memory for SELF header");
+
+    size_t length = fread(header, 1, SELF_HEADER_READ_SIZE, file);
+    fclose(file);
+
+    fingerprint->header_crc = crc32(0L, header, length);
+
+    free(header);
+
+    return 0;
+}
+
+static cJSON *create_fingerprint_json(file_fingerprint_t *fingerprint)
+{
+    cJSON *json = cJSON_CreateObject();
+    ASSERT_NONZERO(json, "Unable to create JSON object");
+
+    cJSON_AddItemToObject(json, JSON_SIZE_KEY, cJSON_CreateNumber(fingerprint->size));
+    cJSON_AddItemToObject(json, JSON_MTIME_KEY, cJSON_CreateNumber(fingerprint->mtime));
+    cJSON_AddItemToObject(json, JSON_HEADER_CRC_KEY, cJSON_CreateNumber(fingerprint->header_crc));
+
+    return json;
+}
+
+static bool fingerprint_matches(cJSON *json, file_fingerprint_t *fingerprint)
+{
+    cJSON *size = cJSON_GetObjectItemCaseSensitive(json, JSON_SIZE_KEY);
+    cJSON *mtime = cJSON_GetObjectItemCaseSensitive(json, JSON_MTIME_KEY);
+    cJSON *header_crc = cJSON_GetObjectItemCaseSensitive(json, JSON_HEADER_CRC_KEY);
+
+    return cJSON_IsNumber(size) && cJSON_IsNumber(mtime) && cJSON_IsNumber(header_crc) &&
+           (uint64_t)size->valuedouble == fingerprint->size &&
+           (uint64_t)mtime->valuedouble == fingerprint->mtime &&
+           (uint32_t)header_crc->valuedouble == fingerprint->header_crc;
+}
+
+static cJSON *find_entry(char *title_id, int *index)
+{
+    int i = 0;
+    cJSON *entry = NULL;
+    cJSON_ArrayForEach(entry, patch_records)
+    {
+        cJSON *entry_title_id = cJSON_GetObjectItemCaseSensitive(entry, JSON_TITLE_ID_KEY);
+
+        if (cJSON_IsString(entry_title_id) && strcmp(entry_title_id->valuestring, title_id) == 0)
+        {
+            if (index != NULL)
+                (*index) = i;
+
+            return entry;
+        }
+
+        i++;
+    }
+
+    return NULL;
+}
+
+void patch_record_load()
+{
+    sys_lwmutex_attr_t mutex_attr = {
+        .name = "PATCHREC",
+        .attr_protocol = SYS_LWMUTEX_PROTOCOL_FIFO,
+        .attr_recursive = SYS_LWMUTEX_ATTR_NOT_RECURSIVE,
+    };
+
+    ASSERT_ZERO(sysLwMutexCreate(&patch_records_mutex, &mutex_attr), "Unable to create patch record mutex");
+
+    FILE *file = fopen(PATCH_RECORD_PATH, "r");
+    if (file != NULL)
+    {
+        // Get its length
+        fseek(file, 0, SEEK_END);
+        size_t file_size = ftell(file);
+        fseek(file, 0, SEEK_SET);
+
+        char *file_data = (char *)malloc(file_size);
+        ASSERT_NONZERO(file_data, "Unable to allocate memory for patch records");
+
+        if (fread(file_data, sizeof(char), file_size, file) == file_size)
+            patch_records = cJSON_ParseWithLength(file_data, file_size);
+
+        fclose(file);
+        free(file_data);
+    }
+
+    // Without records, patched games are still shown as patched, just not to which server
+    if (!cJSON_IsArray(patch_records))
+    {
+        cJSON_Delete(patch_records);
+        patch_records = cJSON_CreateArray();
+        ASSERT_NONZERO(patch_records, "Unable to create JSON array");
+    }
+}
+
+static void get_module_paths(char *game_path, char *name, char *path, char *backup_path)
+{
+    snprintf(path, 512, "%s/USRDIR/%s", game_path, name);
+    snprintf(backup_path, 512, "%s/USRDIR/%s.ORIG", game_path, name);
+}
+
+// The APP_VER of the game as it is now, or 0 if the PARAM.SFO doesn't say
+static double get_app_ver(char *game_path)
+{
+    char param_sfo_path[256] = {0};
+    snprintf(param_sfo_path, 256, "%s/PARAM.SFO", game_path);
+
+    sfo_info_t sfo_info;
+    if (read_sfo(param_sfo_path, &sfo_info) != 0)
+        return 0;
+
+    return strtod(sfo_info.app_ver, NULL);
+}
+
+// Whether every module we recorded is still the one we left behind, along with its backup
+// Must be called with the patch records mutex held
+static bool modules_match(char *game_path, cJSON *entry)
+{
+    cJSON *modules = cJSON_GetObjectItemCaseSensitive(entry, JSON_MODULES_KEY);
+    if (!cJSON_IsArray(modules) || cJSON_GetArraySize(modules) == 0)
+        return false;
+
+    cJSON *module = NULL;
+    cJSON_ArrayForEach(module, modules)
+    {
+        cJSON *name = cJSON_GetObjectItemCaseSensitive(module, JSON_NAME_KEY);
+        if (!cJSON_IsString(name))
+            return false;
+
+        char path[512] = {0};
+        char backup_path[512] = {0};
+        get_module_paths(game_path, name->valuestring, path, backup_path);
+
+        file_fingerprint_t patched;
+        file_fingerprint_t backup;
+        if (fingerprint_file(path, &patched) != 0 || fingerprint_file(backup_path, &backup) != 0 ||
+            !fingerprint_matches(cJSON_GetObjectItemCaseSensitive(module, JSON_PATCHED_KEY), &patched) ||
+            !fingerprint_matches(cJSON_GetObjectItemCaseSensitive(module, JSON_BACKUP_KEY), &backup))
+            return false;
+    }
+
+    return true;
+}
+
+// Whether the game has really been updated since we patched it, rather than its files just looking different
+// Must be called with the patch records mutex held
+static bool game_updated(char *game_path, cJSON *entry)
+{
+    // Updates bump the APP_VER in the PARAM.SFO
+    cJSON *app_ver = cJSON_GetObjectItemCaseSensitive(entry, JSON_APP_VER_KEY);
+    if (cJSON_IsNumber(app_ver) && app_ver->valuedouble > 0 && get_app_ver(game_path) > app_ver->valuedouble)
+        return true;
+
+    // And the app version in the header of every executable they replace
+    cJSON *modules = cJSON_GetObjectItemCaseSensitive(entry, JSON_MODULES_KEY);
+
+    cJSON *module = NULL;
+    cJSON_ArrayForEach(module, modules)
+    {
+        cJSON *name = cJSON_GetObjectItemCaseSensitive(module, JSON_NAME_KEY);
+        cJSON *app_version = cJSON_GetObjectItemCaseSensitive(module, JSON_APP_VERSION_KEY);
+        if (!cJSON_IsString(name) || !cJSON_IsNumber(app_version))
+            continue;
+
+        char path[512] = {0};
+        char backup_path[512] = {0};
+        get_module_paths(game_path, name->valuestring, path, backup_path);
+
+        self_info_t info;
+        if (self_info_get(path, &info) == 0 && info.app_version > (uint64_t)app_version->valuedouble)
+            return true;
+    }
+
+    return false;
+}
+
+int patch_record_probe(char *title_id, char *game_path, patch_record_t *record)
+{
+    memset(record, 0, sizeof(patch_record_t));
+
+    char eboot_path[512] = {0};
+    char backup_path[512] = {0};
+    get_module_paths(game_path, "EBOOT.BIN", eboot_path, backup_path);
+
+    file_fingerprint_t eboot;
+    if (fingerprint_file(eboot_path, &eboot) != 0)
+        return -1;
+
+    // Without a backup, we have never touched the game
+    file_fingerprint_t backup;
+    if (fingerprint_file(backup_path, &backup) != 0)
+    {
+        record->status = PATCH_STATUS_STOCK;
+        return 0;
+    }
+
+    // The backup being put back leaves two copies of the same executable
+    if (eboot.size == backup.size && eboot.header_crc == backup.header_crc)
+    {
+        record->status = PATCH_STATUS_STOCK;
+        return 0;
+    }
+
+    bool updated = false;
+
+    MUTEX_SCOPE(
+        &patch_records_mutex,
+        {
+            cJSON *entry = find_entry(title_id, NULL);
+            if (entry != NULL)
+            {
+                cJSON *server_name = cJSON_GetObjectItemCaseSensitive(entry, JSON_SERVER_NAME_KEY);
+                cJSON *server_url = cJSON_GetObjectItemCaseSensitive(entry, JSON_SERVER_URL_KEY);
+                cJSON *patch_digest = cJSON_GetObjectItemCaseSensitive(entry, JSON_PATCH_DIGEST_KEY);
+
+                // Only trust the record if every module and backup are the ones we left behind
+                if (cJSON_IsString(server_name) && cJSON_IsString(server_url) && modules_match(game_path, entry))
+                {
+                    record->has_server = true;
+                    snprintf(record->server_name, sizeof(record->server_name), "%s", server_name->valuestring);
+                    snprintf(record->server_url, sizeof(record->server_url), "%s", server_url->valuestring);
+                    record->server_patch_digest = cJSON_IsTrue(patch_digest);
+                }
+                else
+                {
+                    updated = game_updated(game_path, entry);
+                }
+            }
+        });
+
+    // Something else has written the modules since we patched them, and the versions say it was a game update
+    if (updated)
+        record->status = PATCH_STATUS_STALE;
+    // Either we patched it, or it was patched before records were kept, or something we can't account for touched it
+    // All we know in the last two cases is that the EBOOT.BIN is not the backup
+    else
+        record->status = PATCH_STATUS_PATCHED;
+
+    return 0;
+}
+
+// Removes the backups of every module a game update replaced, so they are backed up again from the new version
+// Only backups which are still exactly what we recorded are removed, anything else may be the only stock copy left
+void patch_record_drop_stale_backups(char *title_id, char *game_path)
+{
+    MUTEX_SCOPE(
+        &patch_records_mutex,
+        {
+            cJSON *entry = find_entry(title_id, NULL);
+            cJSON *modules = entry != NULL ? cJSON_GetObjectItemCaseSensitive(entry, JSON_MODULES_KEY) : NULL;
+
+            cJSON *module = NULL;
+            cJSON_ArrayForEach(module, modules)
+            {
+                cJSON *name = cJSON_GetObjectItemCaseSensitive(module, JSON_NAME_KEY);
+                if (!cJSON_IsString(name))
+                    continue;
+
+                char path[512] = {0};
+                char backup_path[512] = {0};
+                get_module_paths(game_path, name->valuestring, path, backup_path);
+
+                file_fingerprint_t current;
+                file_fingerprint_t backup;
+                if (fingerprint_file(path, &current) != 0 || fingerprint_file(backup_path, &backup) != 0)
+                    continue;
+
+                // Still the module we patched, so its backup is still the stock copy of it
+                if (fingerprint_matches(cJSON_GetObjectItemCaseSensitive(module, JSON_PATCHED_KEY), &current))
+                    continue;
+
+                if (!fingerprint_matches(cJSON_GetObjectItemCaseSensitive(module, JSON_BACKUP_KEY), &backup))
+                    continue;
+
+                SDL_Log("%s was updated since it was patched, removing its old backup", name->valuestring);
+                unlink(backup_path);
+            }
+        });
+}
+
+int patch_record_store(char *title_id, char *game_path, server_list_entry *server, char **module_names, int module_count)
+{
+    cJSON *modules = cJSON_CreateArray();
+    ASSERT_NONZERO(modules, "Unable to create JSON array");
+
+    for (int i = 0; i < module_count; i++)
+    {
+        char path[512] = {0};
+        char backup_path[512] = {0};
+        get_module_paths(game_path, module_names[i], path, backup_path);
+
+        file_fingerprint_t patched;
+        file_fingerprint_t backup;
+        if (fingerprint_file(path, &patched) != 0 || fingerprint_file(backup_path, &backup) != 0)
+        {
+            cJSON_Delete(modules);
+            return -1;
+        }
+
+        cJSON *module = cJSON_CreateObject();
+        ASSERT_NONZERO(module, "Unable to create JSON object");
+
+        cJSON_AddItemToObject(module, JSON_NAME_KEY, cJSON_CreateString(module_names[i]));
+        cJSON_AddItemToObject(module, JSON_PATCHED_KEY, create_fingerprint_json(&patched));
+        cJSON_AddItemToObject(module, JSON_BACKUP_KEY, create_fingerprint_json(&backup));
+
+        // The stock app version, which a game update replacing the module will have raised
+        self_info_t info;
+        if (self_info_get(backup_path, &info) == 0)
+            cJSON_AddItemToObject(module, JSON_APP_VERSION_KEY, cJSON_CreateNumber(info.app_version));
+
+        cJSON_AddItemToArray(modules, module);
+    }
+
+    SDL_Log("Storing patch record for %s, patched to %s", title_id, server->name);
+
+    cJSON *entry = cJSON_CreateObject();
+    ASSERT_NONZERO(entry, "Unable to create JSON object");
+
+    cJSON_AddItemToObject(entry, JSON_TITLE_ID_KEY, cJSON_CreateString(title_id));
+    cJSON_AddItemToObject(entry, JSON_SERVER_NAME_KEY, cJSON_CreateString(server->name));
+    cJSON_AddItemToObject(entry, JSON_SERVER_URL_KEY, cJSON_CreateString(server->url));
+    cJSON_AddItemToObject(entry, JSON_PATCH_DIGEST_KEY, cJSON_CreateBool(server->patch_digest));
+    cJSON_AddItemToObject(entry, JSON_APP_VER_KEY, cJSON_CreateNumber(get_app_ver(game_path)));
+    cJSON_AddItemToObject(entry, JSON_MODULES_KEY, modules);
+
+    char *json_string = NULL;
+
+    MUTEX_SCOPE(
+        &patch_records_mutex,
+        {
+            // Replace any old record for this game
+            int index;
+            if (find_entry(title_id, &index) != NULL)
+                cJSON_DeleteItemFromArray(patch_records, index);
+
+            cJSON_AddItemToArray(patch_records, entry);
+
+            json_string = cJSON_Print(patch_records);
+        });
+
+    ASSERT_NONZERO(json_string, "Unable to convert JSON to string");
+
+    FILE *file = fopen(PATCH_RECORD_PATH, "w");
+    if (file == NULL)
+    {
+        SDL_Log("Unable to open patch records for writing");
+        cJSON_free(json_string);
+        return -1;
+    }
+
+    fputs(json_string, file);
+    fclose(file);
+
+    cJSON_free(json_string);
+
+    return 0;
+}
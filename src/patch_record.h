@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "game_list.h"
+#include "server_list.h"
+
+// What a probe found out about a game's modules
+typedef struct patch_record_t
+{
+    // Never PATCH_STATUS_UNPATCHABLE, that is decided from the game's executable type
+    PATCH_STATUS status;
+    // Only set if the status is patched and the game was patched by this version of the app
+    bool has_server;
+    char server_name[256];
+    char server_url[256];
+    bool server_patch_digest;
+} patch_record_t;
+
+void patch_record_load();
+int patch_record_probe(char *title_id, char *game_path, patch_record_t *record);
+void patch_record_drop_stale_backups(char *title_id, char *game_path);
+int patch_record_store(char *title_id, char *game_path, server_list_entry *server, char **module_names, int module_count);
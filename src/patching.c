@@ -1,163 +1,339 @@
 #include <tre.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <dirent.h>
+#include <strings.h>
+#include <zlib.h>
+#include <sys/stat.h>
+#include <cJSON.h>
 
 #include "assert.h"
+#include "endian.h"
 #include "types.h"
-#include "scetool.h"
+#include "scetool_context.h"
 #include "copyfile.h"
 #include "license.h"
 #include "digest.h"
+#include "delta_patch.h"
+#include "http_pool.h"
+#include "save_manager.h"
+#include "job_pool.h"
+#include "slot_index.h"
+#include "elf_image.h"
+#include "self_header.h"
+#include "self_info.h"
+#include "patch_record.h"
+#include "game_cache.h"
+
+// The PPU has two hardware threads, so there is no point in running more modules than that at once
+#define PATCH_WORKER_COUNT 2
+#define PATCH_WORKER_STACK_SIZE 0x10000
+
+// Deltas fetched from a server are kept here, under a hash of the server's URL
+#define DELTA_DIR GAME_DIR "deltas/"
+
+// Servers list the deltas they publish at /deltas/index.json, a JSON array of delta file names
+// It is fetched once per server, so a server without deltas costs one request rather than one per module
+#define DELTA_INDEX_MAX_SIZE (64 * 1024)
+#define DELTA_INDEX_CACHE_SIZE 8
+// How long an index, or not being able to get one, is trusted before asking the server again
+#define DELTA_INDEX_TTL_MS (10 * 60 * 1000)
+
+// Upper bound on how many SELF modules we will patch in one game
+#define PATCH_MAX_MODULES 64
+
+typedef struct patch_module_t
+{
+    state_t *state;
+    // Path relative to USRDIR, used for logging and to find deltas
+    char name[256];
+    char path[512];
+    char backup_path[512];
+    char decrypted_path[512];
+    char patched_path[512];
+    // Where the re-encrypted module is written before being committed over path
+    char output_path[512];
+    // Where the re-encrypted module is decrypted again to be checked
+    char verify_path[512];
+    bool is_eboot;
+    bool modified;
+    bool has_output;
+    // Set once the whole image has been searched, so the slots below are complete
+    bool scanned;
+    url_slot_t slots[URL_SLOT_MAX];
+    int slot_count;
+    // The game's keys and license, plus this module's own content id
+    scetool_context_t scetool;
+    // The deltas the server publishes, NULL if it doesn't have any, shared by every module and never written to
+    cJSON *delta_index;
+    // What the encrypted output has to decrypt back to, taken from the patched image as it is written
+    uint64_t entry;
+    int segment_count;
+    elf_segment_t segments[ELF_MAX_SEGMENTS];
+    uint32_t segment_crcs[ELF_MAX_SEGMENTS];
+    char *error;
+} patch_module_t;
+
+static void set_patching_state(state_t *state, PATCHING_STATE patching_state)
+{
+    MUTEX_SCOPE(
+        state->patching_info.mutex,
+        {
+            state->patching_info.state = patching_state;
+        });
+}
 
-void patch_game(void *arg)
+static void fail_patching(state_t *state, char *error)
 {
-    state_t *state = (state_t *)arg;
+    // Set the state to error
+    MUTEX_SCOPE(
+        state->patching_info.mutex,
+        {
+            state->patching_info.state = PATCHING_STATE_ERROR;
+            state->patching_info.is_running = false;
+            state->patching_info.last_error = error;
+        });
+}
 
-    // Re-Init libscetool
-    ASSERT_ZERO(libscetool_init(), "Unable to initialize libscetool");
+static bool is_self_file(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+        return false;
 
-    // Get the path to the EBOOT.BIN
-    char eboot_path[256] = {0};
-    snprintf(eboot_path, 256, "%s/USRDIR/EBOOT.BIN", state->selected_game->path);
+    // Check for header of SCE\0
+    char magic[4] = {0};
+    bool is_self = fread(magic, 1, 4, file) == 4 && memcmp(magic, "SCE\0", 4) == 0;
 
-    // Get the path to the EBOOT.BIN.ORIG
-    char eboot_backup_path[256] = {0};
-    snprintf(eboot_backup_path, 256, "%s/USRDIR/EBOOT.BIN.ORIG", state->selected_game->path);
+    fclose(file);
 
-    // Get the path to the patched EBOOT.BIN.PATCHED
-    char patched_eboot_path[256] = {0};
-    snprintf(patched_eboot_path, 256, "%s/USRDIR/EBOOT.BIN.PATCHED", state->selected_game->path);
+    return is_self;
+}
 
-    SDL_Log("Backing up EBOOT.BIN if it doesn't exist");
+static bool is_module_name(const char *name)
+{
+    size_t length = strlen(name);
 
-    // If the backup EBOOT does not exist
-    if (access(eboot_backup_path, F_OK) != 0)
-    {
-        // Set the state to backing up
-        MUTEX_SCOPE(
-            state->patching_info.mutex,
-            {
-                state->patching_info.state = PATCHING_STATE_BACKING_UP;
-            });
+    if (strcmp(name, "EBOOT.BIN") == 0)
+        return true;
 
-        // Copy the EBOOT.BIN to EBOOT.BIN.ORIG
-        ASSERT_ZERO(copy_file(eboot_backup_path, eboot_path), "Unable to copy EBOOT.BIN to EBOOT.BIN.ORIG");
-    }
+    if (length < 5)
+        return false;
 
-    SDL_Log("Set encrypt options");
+    return strcasecmp(name + length - 5, ".self") == 0 || strcasecmp(name + length - 5, ".sprx") == 0;
+}
 
-    // If this is an NPDRM game, set the NPDRM encrypt options
-    if (state->selected_game->title_id[0] == 'N')
-        set_npdrm_encrypt_options();
-    // Otherwise, set the disc encrypt options
-    else
-        set_disc_encrypt_options();
+static void find_modules(state_t *state, const char *path, const char *relative, patch_module_t *modules, int *count)
+{
+    DIR *directory = opendir(path);
+    if (directory == NULL)
+        return;
 
-    // Set the state to decrypting
-    MUTEX_SCOPE(
-        state->patching_info.mutex,
+    struct dirent *entry = NULL;
+    while ((entry = readdir(directory)) != NULL && *count < PATCH_MAX_MODULES)
+    {
+        // Skip over . and ..
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+
+        char full_path[512] = {0};
+        snprintf(full_path, 512, "%s/%s", path, entry->d_name);
+
+        char name[256] = {0};
+        snprintf(name, 256, "%s%s%s", relative, relative[0] ? "/" : "", entry->d_name);
+
+        if (entry->d_type == DT_DIR)
         {
-            state->patching_info.state = PATCHING_STATE_DECRYPTING;
-        });
+            find_modules(state, full_path, name, modules, count);
+            continue;
+        }
 
-    SDL_Log("Setting IDPS key");
+        if (entry->d_type != DT_REG || !is_module_name(entry->d_name) || !is_self_file(full_path))
+            continue;
 
-    set_idps_key(state->idps);
+        SDL_Log("Found module: %s", name);
 
-    SDL_Log("Getting content id");
+        patch_module_t *module = &modules[*count];
+        memset(module, 0, sizeof(patch_module_t));
+
+        module->state = state;
+        module->is_eboot = strcmp(name, "EBOOT.BIN") == 0;
+        snprintf(module->name, 256, "%s", name);
+        snprintf(module->path, 512, "%s", full_path);
+        snprintf(module->backup_path, 512, "%s.ORIG", full_path);
+        snprintf(module->decrypted_path, 512, "%s.DEC", full_path);
+        snprintf(module->patched_path, 512, "%s.PATCHED", full_path);
+        snprintf(module->output_path, 512, "%s.NEW", full_path);
+        snprintf(module->verify_path, 512, "%s.VERIFY", full_path);
 
-    // Get the content id
-    char *content_id = get_content_id(eboot_backup_path);
+        (*count)++;
+    }
+
+    closedir(directory);
+}
+
+typedef struct delta_index_t
+{
+    bool used;
+    uint32_t server_crc;
+    uint32_t fetched_ticks;
+    // NULL when the server has no index, or couldn't be reached
+    cJSON *names;
+} delta_index_t;
+
+// Only touched by the patching thread, before any module jobs start
+static delta_index_t delta_indexes[DELTA_INDEX_CACHE_SIZE];
 
-    // If the content id is NULL
-    if (content_id == NULL)
+static uint32_t hash_server_url(char *server_url)
+{
+    return crc32(0, (const uint8_t *)server_url, strlen(server_url));
+}
+
+// Gets the list of deltas the selected server publishes, remembering failures as well so they aren't retried for every game
+static cJSON *get_delta_index(state_t *state)
+{
+    uint32_t server_crc = hash_server_url(state->selected_server->url);
+    uint32_t now = SDL_GetTicks();
+
+    // Reuse the entry for this server, otherwise the oldest one
+    delta_index_t *index = NULL;
+    for (int i = 0; i < DELTA_INDEX_CACHE_SIZE; i++)
     {
-        // Set the state to error
-        MUTEX_SCOPE(
-            state->patching_info.mutex,
-            {
-                state->patching_info.state = PATCHING_STATE_ERROR;
-                state->patching_info.is_running = false;
-                state->patching_info.last_error = "Unable to get content id of executable.";
-            });
+        delta_index_t *entry = &delta_indexes[i];
 
-        return;
+        if (entry->used && entry->server_crc == server_crc)
+        {
+            index = entry;
+            break;
+        }
+
+        if (index == NULL || !entry->used || (index->used && entry->fetched_ticks < index->fetched_ticks))
+            index = entry;
     }
 
-    SDL_Log("Content id: %.*s", 0x30, content_id);
+    if (index->used && index->server_crc == server_crc && now - index->fetched_ticks < DELTA_INDEX_TTL_MS)
+        return index->names;
 
-    SDL_Log("Setting content id");
+    cJSON_Delete(index->names);
+    memset(index, 0, sizeof(delta_index_t));
 
-    set_npdrm_content_id(content_id);
+    index->used = true;
+    index->server_crc = server_crc;
 
-    // Get a temp path for the decrypted EBOOT.BIN
-    char eboot_decrypted_path[256] = {0};
-    snprintf(eboot_decrypted_path, 256, "%s/USRDIR/EBOOT.BIN.DEC", state->selected_game->path);
+    char *url = http_pool_origin_url(state->selected_server->url, "/deltas/index.json");
 
-    // Only search for license if it's an NPDRM game
-    if (state->selected_game->title_id[0] == 'N')
+    uint8_t *data = NULL;
+    size_t size = 0;
+    if (http_pool_fetch(state->http_pool, url, DELTA_INDEX_MAX_SIZE, &data, &size) == 0)
     {
-        SDL_Log("Finding license");
+        index->names = cJSON_ParseWithLength((const char *)data, size);
+        free(data);
 
-        // Find the license
-        char *license_path = find_license_from_all_users(content_id);
-
-        // If the license is NULL
-        if (license_path == NULL)
+        if (!cJSON_IsArray(index->names))
         {
-            // Set the state to error
-            MUTEX_SCOPE(
-                state->patching_info.mutex,
-                {
-                    state->patching_info.state = PATCHING_STATE_ERROR;
-                    state->patching_info.is_running = false;
-                    state->patching_info.last_error = "Unable to find license.";
-                });
-
-            return;
+            SDL_Log("Delta index from %s is not a list, ignoring it", url);
+            cJSON_Delete(index->names);
+            index->names = NULL;
         }
+    }
 
-        SDL_Log("Setting license paths");
+    free(url);
 
-        set_rif_file_path(license_path);
-        rap_set_directory(license_path);
+    // Taken after the fetch, so a slow failure isn't retried straight away
+    index->fetched_ticks = SDL_GetTicks();
+
+    return index->names;
+}
+
+static bool delta_index_has(cJSON *delta_index, char *delta_name)
+{
+    cJSON *name = NULL;
+    cJSON_ArrayForEach(name, delta_index)
+    {
+        if (cJSON_IsString(name) && strcmp(name->valuestring, delta_name) == 0)
+            return true;
     }
 
-    SDL_Log("Decrypting");
+    return false;
+}
+
+// Fetches the delta from the server, keeping a copy so it doesn't have to be fetched again
+static delta_patch_t *fetch_delta(state_t *state, char *delta_dir, char *delta_path, char *delta_name)
+{
+    char url_path[64] = {0};
+    snprintf(url_path, 64, "/deltas/%s", delta_name);
 
-    // Decrypt the EBOOT.BIN.ORIG
-    // The reason we always decrypt the EBOOT.BIN.ORIG is because the EBOOT.BIN might have its digest patched.
-    frontend_decrypt(eboot_backup_path, eboot_decrypted_path);
+    char *url = http_pool_origin_url(state->selected_server->url, url_path);
 
-    SDL_Log("Searching");
+    uint8_t *data = NULL;
+    size_t size = 0;
+    int ret = http_pool_fetch(state->http_pool, url, DELTA_MAX_SIZE, &data, &size);
 
-    // Set the state to decrypting, since now we are searching for patchable elements in the EBOOT.BIN.DEC
-    MUTEX_SCOPE(
-        state->patching_info.mutex,
+    free(url);
+
+    // Most servers won't have a delta for most modules, so this isn't worth more than the log from the fetch
+    if (ret != 0)
+        return NULL;
+
+    if ((access(DELTA_DIR, F_OK) == 0 || mkdir(DELTA_DIR, 0777) == 0) &&
+        (access(delta_dir, F_OK) == 0 || mkdir(delta_dir, 0777) == 0))
+    {
+        FILE *file = fopen(delta_path, "wb");
+        if (file != NULL)
         {
-            state->patching_info.state = PATCHING_STATE_SEARCHING;
-        });
+            bool written = fwrite(data, 1, size, file) == size;
+
+            // Don't leave a broken copy to be found next time
+            if (fclose(file) != 0 || !written)
+                unlink(delta_path);
+        }
+    }
+
+    delta_patch_t *delta = delta_parse(data, size, delta_name);
 
-    // Open the decrypted EBOOT.BIN
-    FILE *eboot_decrypted = fopen(eboot_decrypted_path, "rb");
-    ASSERT_NONZERO(eboot_decrypted, "Unable to open decrypted EBOOT.BIN");
+    // Nothing would ever replace a copy of an invalid delta
+    if (delta == NULL)
+        unlink(delta_path);
 
-    // Get the size of the decrypted EBOOT.BIN
-    fseek(eboot_decrypted, 0, SEEK_END);
-    size_t eboot_decrypted_size = ftell(eboot_decrypted);
-    fseek(eboot_decrypted, 0, SEEK_SET);
+    return delta;
+}
 
-    // Allocate memory for the decrypted EBOOT.BIN
-    uint8_t *eboot_decrypted_data = (uint8_t *)malloc(eboot_decrypted_size);
-    ASSERT_NONZERO(eboot_decrypted_data, "Unable to allocate memory for decrypted EBOOT.BIN");
+// Looks for a delta the server published for this exact image, first in the ones we already have
+static delta_patch_t *find_delta(state_t *state, cJSON *delta_index, size_t size, uint32_t image_crc)
+{
+    // The server's URL is typed in by the user, so it is hashed rather than trusted as a directory name
+    char delta_dir[256] = {0};
+    snprintf(delta_dir, 256, DELTA_DIR "%08x", hash_server_url(state->selected_server->url));
+
+    // Deltas are named after the image they apply to, so the name says nothing about the game either
+    char delta_name[64] = {0};
+    snprintf(delta_name, 64, "%016llx%08x.delta", (unsigned long long)size, image_crc);
+
+    char delta_path[512] = {0};
+    snprintf(delta_path, 512, "%s/%s", delta_dir, delta_name);
 
-    while (fread(eboot_decrypted_data, sizeof(uint8_t), eboot_decrypted_size, eboot_decrypted) > 0)
+    delta_patch_t *delta = delta_load(delta_path);
+    if (delta != NULL)
     {
-        SDL_Log("Read %d bytes", eboot_decrypted_size);
+        SDL_Log("Found delta %s", delta_path);
+        return delta;
     }
 
-    // Close the decrypted EBOOT.BIN
-    ASSERT_ZERO(fclose(eboot_decrypted), "Unable to close decrypted EBOOT.BIN");
+    // Only ask the server for deltas it says it has
+    if (!delta_index_has(delta_index, delta_name))
+        return NULL;
+
+    delta = fetch_delta(state, delta_dir, delta_path, delta_name);
+    if (delta != NULL)
+        SDL_Log("Fetched delta %s", delta_name);
+
+    return delta;
+}
+
+static int patch_image(patch_module_t *module, uint8_t *data, size_t size)
+{
+    state_t *state = module->state;
+    int result = 0;
 
     char *url_regex_str = "^https?[^\\x00]//([0-9a-zA-Z.:].*)/?([0-9a-zA-Z_]*)$";
 
@@ -165,14 +341,53 @@ void patch_game(void *arg)
     // Compile the URL regex
     ASSERT_ZERO(tre_regncomp(&url_regex, url_regex_str, strlen(url_regex_str), REG_EXTENDED), "Unable to compile url regex");
 
-    // Iterate over ever 4 byte chunk in the decrypted EBOOT.BIN
-    for (size_t i = 0; i < eboot_decrypted_size; i += 4)
+    // Deltas are published for one exact image, so the whole thing is fingerprinted
+    uint32_t image_crc = crc32(0, data, size);
+
+    bool delta_applied = false;
+    delta_patch_t *delta = find_delta(state, module->delta_index, size, image_crc);
+    if (delta != NULL)
+    {
+        if (!delta_matches(delta, size, image_crc))
+            SDL_Log("Delta does not match %s, falling back to searching", module->name);
+        else if (delta_apply(delta, data, size) != 0)
+            SDL_Log("Unable to apply delta, falling back to searching");
+        else
+            delta_applied = module->modified = true;
+
+        delta_free(delta);
+    }
+
+    // Find the digest key through what references it, rather than guessing around cookie strings
+    bool digest_located = false;
+    if (!delta_applied)
     {
-        char *str = (char *)eboot_decrypted_data + i;
+        digest_candidate_t candidates[DIGEST_MAX_CANDIDATES];
+        int candidate_count = locate_digests(data, size, DIGEST_MIN_CONFIDENCE, candidates, DIGEST_MAX_CANDIDATES);
 
-        if (memcmp(eboot_decrypted_data + i, "http", 4) == 0)
+        for (int i = 0; i < candidate_count; i++)
         {
-            SDL_Log("Found URL at address %x, %s", i, str);
+            char *digest = (char *)data + candidates[i].offset;
+
+            SDL_Log("Located digest at address %zx, %s, confidence %d. Patching...", candidates[i].offset, digest, candidates[i].confidence);
+
+            // Copy the new digest in
+            strcpy(digest, "CustomServerDigest");
+
+            module->modified = true;
+            digest_located = true;
+        }
+    }
+
+    // Iterate over ever 4 byte chunk in the decrypted image
+    for (size_t i = 0; i + 4 <= size && !delta_applied; i += 4)
+    {
+        char *str = (char *)data + i;
+
+        // Strings that run off the end of the image aren't real ones, and would take the string functions with them
+        if (memcmp(data + i, "http", 4) == 0 && strnlen(str, size - i) < size - i)
+        {
+            SDL_Log("Found URL at address %zx, %s", i, str);
 
             // find a match
             regmatch_t match[1];
@@ -187,7 +402,10 @@ void patch_game(void *arg)
                 char err_str[1024] = {0};
                 tre_regerror(ret, &url_regex, err_str, 1024);
                 SDL_Log("Matching url failed for some reason! err: %s", err_str);
-                exit(1);
+
+                module->error = "Unable to search executable.";
+                result = -1;
+                break;
             }
             else
             {
@@ -200,52 +418,62 @@ void patch_game(void *arg)
 
                     // Count null bytes after str until next non-null byte
                     int null_bytes = 0;
-                    for (int i = strlen(str); str[i] == '\0'; i++)
+                    for (size_t k = strlen(str); i + k < size && str[k] == '\0'; k++)
                     {
                         null_bytes++;
                     }
 
-                    if (strlen(state->selected_server->url) > (strlen(str) + null_bytes - 1))
+                    int capacity = strlen(str) + null_bytes - 1;
+
+                    // Remember the slot, so the next attempt knows what fits without decrypting
+                    if (module->slot_count < URL_SLOT_MAX)
+                    {
+                        url_slot_t *slot = &module->slots[module->slot_count++];
+                        slot->module = module->name;
+                        slot->offset = i;
+                        slot->capacity = capacity;
+                    }
+
+                    if (strlen(state->selected_server->url) > capacity)
                     {
-                        // Set the state to error
-                        MUTEX_SCOPE(
-                            state->patching_info.mutex,
-                            {
-                                state->patching_info.state = PATCHING_STATE_ERROR;
-                                state->patching_info.is_running = false;
-                                state->patching_info.last_error = "URL too long to fit in EBOOT.";
-                            });
-
-                        // Get outta here
-                        goto out;
+                        module->error = "URL too long to fit in EBOOT.";
+
+                        // Keep searching without patching, so every slot still gets recorded
+                        result = -1;
+                        continue;
                     }
 
-                    SDL_Log("Found valid URL at address %x, %s. Patching...", i, str);
+                    SDL_Log("Found valid URL at address %zx, %s. Patching...", i, str);
 
                     // Null out the original string
                     memset(str, '\0', strlen(str));
 
                     // Copy the new URL in
                     strcpy(str, state->selected_server->url);
+
+                    module->modified = true;
                 }
             }
         }
         // If we find the word "cookie", then we know that the digest key is somewhere near it
-        else if (memcmp(eboot_decrypted_data + i, "cookie", 7) == 0)
+        // This is only a fallback for when the locator above could not find the digest through references
+        else if (!digest_located && i + 7 <= size && memcmp(data + i, "cookie", 7) == 0)
         {
-            SDL_Log("Found cookie at address %x, %s", i, str);
+            SDL_Log("Found cookie at address %zx, %s", i, str);
 
             const int digest_key_range = 1000;
 
-            size_t start = i - digest_key_range;
-            size_t end = i + digest_key_range;
+            // Keep the window inside the image
+            size_t start = i > digest_key_range ? i - digest_key_range : 0;
+            size_t end = i + digest_key_range < size ? i + digest_key_range : size;
 
             for (size_t j = start; j < end; j += 1)
             {
-                char *search_str = (char *)eboot_decrypted_data + j;
+                char *search_str = (char *)data + j;
 
-                int len = strlen(search_str);
-                if (len != 18)
+                // A string with no terminator before the end of the image can't be the digest
+                size_t len = strnlen(search_str, size - j);
+                if (len != 18 || j + len >= size)
                 {
                     j += len;
                     continue;
@@ -253,51 +481,316 @@ void patch_game(void *arg)
 
                 if (valid_digest(search_str))
                 {
-                    SDL_Log("Found digest at address %x, %s. Patching...", j, search_str);
+                    SDL_Log("Found digest at address %zx, %s. Patching...", j, search_str);
 
                     // Copy the new digest in
                     strcpy(search_str, "CustomServerDigest");
+
+                    module->modified = true;
                 }
             }
         }
     }
 
-    // Write out the patched EBOOT.ELF to EBOOT.BIN.PATCHED
-    FILE *eboot_patched = fopen(patched_eboot_path, "wb");
-    ASSERT_NONZERO(eboot_patched, "Unable to open patched EBOOT.BIN");
+    module->scanned = !delta_applied;
+
+    tre_regfree(&url_regex);
+
+    return result;
+}
+
+static void record_plaintext(patch_module_t *module, const uint8_t *data, size_t size)
+{
+    elf_image_t image;
+    if (elf_image_parse(&image, data, size) != 0)
+    {
+        SDL_Log("Unable to parse %s as an ELF, it will not be verified", module->name);
+        return;
+    }
+
+    module->entry = image.entry;
+    module->segment_count = image.segment_count;
+    memcpy(module->segments, image.segments, sizeof(elf_segment_t) * image.segment_count);
+
+    for (int i = 0; i < image.segment_count; i++)
+        module->segment_crcs[i] = crc32(0, data + image.segments[i].offset, image.segments[i].filesz);
+}
+
+// Decrypts the encrypted output again and checks it against the patched image, so a broken encrypt is never committed
+static int verify_module(patch_module_t *module)
+{
+    // If the patched image wasn't an ELF we can read, there is nothing to compare against
+    if (module->segment_count == 0)
+        return 0;
+
+    // NPDRM executables have to keep the content id they were decrypted with, which is readable without decrypting
+    self_header_t header;
+    if (self_header_read(module->output_path, &header) != 0)
+    {
+        SDL_Log("Unable to read SELF header of %s", module->output_path);
+        return -1;
+    }
+
+    bool content_id_matches = !header.has_content_id || memcmp(header.content_id, module->scetool.content_id, SELF_CONTENT_ID_LENGTH) == 0;
+
+    self_header_free(&header);
+
+    if (!content_id_matches)
+    {
+        SDL_Log("Content id of %s does not match", module->name);
+        return -1;
+    }
+
+    scetool_decrypt(&module->scetool, module->output_path, module->verify_path);
+
+    FILE *verify = fopen(module->verify_path, "rb");
+    if (verify == NULL)
+    {
+        SDL_Log("Unable to decrypt %s again", module->output_path);
+        return -1;
+    }
+
+    // Get the size of the decrypted output
+    fseek(verify, 0, SEEK_END);
+    size_t verify_size = ftell(verify);
+    fseek(verify, 0, SEEK_SET);
+
+    uint8_t *verify_data = (uint8_t *)malloc(verify_size);
+    ASSERT_NONZERO(verify_data, "Unable to allocate memory for decrypted output");
+
+    bool read = fread(verify_data, 1, verify_size, verify) == verify_size;
+
+    ASSERT_ZERO(fclose(verify), "Unable to close decrypted output");
+    unlink(module->verify_path);
+
+    int result = 0;
+
+    elf_image_t image;
+    if (!read || elf_image_parse(&image, verify_data, verify_size) != 0)
+    {
+        SDL_Log("Unable to read %s back as an ELF", module->output_path);
+        result = -1;
+    }
+    else if (image.entry != module->entry || image.segment_count != module->segment_count)
+    {
+        SDL_Log("Entry point or segments of %s do not match", module->name);
+        result = -1;
+    }
+
+    // Only the loadable segments are compared, scetool doesn't have to lay the rest of the ELF out the same way
+    for (int i = 0; i < module->segment_count && result == 0; i++)
+    {
+        elf_segment_t *expected = &module->segments[i];
+        elf_segment_t *actual = &image.segments[i];
+
+        if (actual->vaddr != expected->vaddr || actual->filesz != expected->filesz || actual->memsz != expected->memsz ||
+            crc32(0, verify_data + actual->offset, actual->filesz) != module->segment_crcs[i])
+        {
+            SDL_Log("Segment %d of %s does not match the patched image", expected->index, module->name);
+            result = -1;
+        }
+    }
+
+    free(verify_data);
+
+    return result;
+}
+
+static void finish_module(patch_module_t *module)
+{
+    MUTEX_SCOPE(
+        module->state->patching_info.mutex,
+        {
+            module->state->patching_info.modules_done++;
+        });
+}
+
+static void patch_module(void *arg)
+{
+    patch_module_t *module = (patch_module_t *)arg;
+    state_t *state = module->state;
+
+    // The reason we always decrypt the backup is because the module might have its digest patched.
+    // Without a backup we have never touched the module, so it is still the stock one
+    bool has_backup = access(module->backup_path, F_OK) == 0;
+    char *source_path = has_backup ? module->backup_path : module->path;
+
+    set_patching_state(state, PATCHING_STATE_DECRYPTING);
+
+    SDL_Log("Decrypting %s", module->name);
+
+    // Get the content id, from the header cache if it has one, otherwise ask scetool
+    self_info_t self_info;
+    char content_id[SELF_CONTENT_ID_LENGTH + 1] = {0};
+    bool has_content_id = false;
+    if (self_info_get(source_path, &self_info) == 0 && self_info.has_content_id)
+    {
+        memcpy(content_id, self_info.content_id, sizeof(content_id));
+        has_content_id = true;
+    }
+    else
+    {
+        has_content_id = scetool_read_content_id(source_path, content_id) == 0;
+    }
+
+    if (has_content_id)
+    {
+        scetool_context_set_content_id(&module->scetool, content_id);
+
+        scetool_decrypt(&module->scetool, source_path, module->decrypted_path);
+    }
+
+    // If there is no content id, nothing was decrypted
+    if (!has_content_id)
+    {
+        module->error = "Unable to get content id of executable.";
+        return;
+    }
+
+    set_patching_state(state, PATCHING_STATE_SEARCHING);
+
+    // Open the decrypted module, scetool doesn't say when it fails, it just doesn't write anything
+    FILE *decrypted = fopen(module->decrypted_path, "rb");
+    if (decrypted == NULL)
+    {
+        SDL_Log("Unable to open decrypted %s", module->name);
+        module->error = "Unable to decrypt executable.";
+        return;
+    }
+
+    // Get the size of the decrypted module
+    fseek(decrypted, 0, SEEK_END);
+    size_t decrypted_size = ftell(decrypted);
+    fseek(decrypted, 0, SEEK_SET);
+
+    // Allocate memory for the decrypted module, one module failing shouldn't take the rest of the game down with it
+    uint8_t *decrypted_data = (uint8_t *)malloc(decrypted_size);
+    if (decrypted_data == NULL)
+    {
+        SDL_Log("Unable to allocate memory for decrypted %s", module->name);
+        fclose(decrypted);
+        module->error = "Not enough memory to patch executable.";
+        return;
+    }
+
+    while (fread(decrypted_data, sizeof(uint8_t), decrypted_size, decrypted) > 0)
+    {
+        SDL_Log("Read %zu bytes", decrypted_size);
+    }
+
+    // Close the decrypted module
+    ASSERT_ZERO(fclose(decrypted), "Unable to close decrypted module");
+
+    if (patch_image(module, decrypted_data, decrypted_size) != 0)
+    {
+        free(decrypted_data);
+        return;
+    }
+
+    // Extra modules without anything to patch are left alone, the EBOOT.BIN is always rewritten
+    if (!module->modified && !module->is_eboot)
+    {
+        SDL_Log("Nothing to patch in %s", module->name);
+
+        free(decrypted_data);
+        finish_module(module);
+        return;
+    }
+
+    // Only modules we are going to replace need a backup
+    if (!has_backup)
+    {
+        set_patching_state(state, PATCHING_STATE_BACKING_UP);
+
+        if (copy_file(module->backup_path, module->path) != 0)
+        {
+            free(decrypted_data);
+            module->error = "Unable to back up executable.";
+            return;
+        }
+
+        set_patching_state(state, PATCHING_STATE_SEARCHING);
+    }
+
+    // Remember what the encrypted output should decrypt back to
+    record_plaintext(module, decrypted_data, decrypted_size);
+
+    // Write out the patched ELF
+    FILE *patched = fopen(module->patched_path, "wb");
+    if (patched == NULL)
+    {
+        SDL_Log("Unable to open %s", module->patched_path);
+        free(decrypted_data);
+        module->error = "Unable to write patched executable.";
+        return;
+    }
 
-    SDL_Log("Writing patched EBOOT.BIN.PATCHED");
+    SDL_Log("Writing patched %s", module->patched_path);
 
-    int to_write = eboot_decrypted_size;
+    bool written_ok = true;
+    size_t to_write = decrypted_size;
     while (to_write > 0)
     {
-        int written = fwrite(eboot_decrypted_data + (eboot_decrypted_size - to_write), sizeof(uint8_t), to_write, eboot_patched);
-        if (written <= 0)
+        size_t written = fwrite(decrypted_data + (decrypted_size - to_write), sizeof(uint8_t), to_write, patched);
+        if (written == 0)
         {
-            SDL_Log("Unable to write to patched EBOOT.BIN");
-            exit(1);
+            SDL_Log("Unable to write to patched module");
+            written_ok = false;
+            break;
         }
 
         to_write -= written;
     }
 
-    // Close the patched EBOOT.BIN
-    ASSERT_ZERO(fclose(eboot_patched), "Unable to close patched EBOOT.BIN");
+    // Close the patched module
+    written_ok &= fclose(patched) == 0;
 
-    free(eboot_decrypted_data);
+    free(decrypted_data);
 
-    SDL_Log("Encrypting");
+    if (!written_ok)
+    {
+        module->error = "Unable to write patched executable.";
+        return;
+    }
+
+    SDL_Log("Encrypting %s", module->name);
+
+    set_patching_state(state, PATCHING_STATE_ENCRYPTING);
+
+    // Encrypt the patched module next to the original, it gets moved into place once every module is done
+    scetool_encrypt(&module->scetool, module->patched_path, module->output_path);
+
+    module->has_output = true;
+
+    if (verify_module(module) != 0)
+    {
+        module->error = "Encrypted executable failed verification.";
+        return;
+    }
+
+    finish_module(module);
+}
+
+// Probes the game we just worked on again, so the list shows what it is now
+static void refresh_game_status(state_t *state)
+{
+    patch_record_t record;
+    if (patch_record_probe(state->selected_game->title_id, state->selected_game->path, &record) != 0)
+        return;
 
-    // Set the state to done
     MUTEX_SCOPE(
-        state->patching_info.mutex,
+        state->games_mutex,
         {
-            state->patching_info.state = PATCHING_STATE_ENCRYPTING;
+            free(state->selected_game->patched_server);
+            state->selected_game->patched_server = record.has_server ? strdup(record.server_name) : NULL;
+            state->selected_game->status = record.status;
         });
 
-    // Encrypt the patched EBOOT.BIN
-    frontend_encrypt(patched_eboot_path, eboot_path);
+    game_cache_set_status(state->selected_game->path, record.status, record.has_server ? record.server_name : NULL);
+}
 
+static void finish_patching(state_t *state)
+{
     // Set the state to done
     MUTEX_SCOPE(
         state->patching_info.mutex,
@@ -306,9 +799,264 @@ void patch_game(void *arg)
             state->patching_info.is_running = false;
             state->patching_info.last_error = NULL;
         });
+}
 
-out:
-    tre_regfree(&url_regex);
+static int commit_modules(patch_module_t *modules, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        if (!modules[i].has_output)
+            continue;
+
+        // Move the re-encrypted module over the original
+        unlink(modules[i].path);
+        if (rename(modules[i].output_path, modules[i].path) == 0)
+            continue;
+
+        SDL_Log("Unable to move %s into place, restoring backups", modules[i].output_path);
+
+        // Put every module we already replaced back to its backup, so the game is never half patched
+        for (int j = 0; j <= i; j++)
+        {
+            if (!modules[j].has_output)
+                continue;
+
+            unlink(modules[j].path);
+            copy_file(modules[j].path, modules[j].backup_path);
+        }
+
+        return -1;
+    }
+
+    return 0;
+}
+
+void patch_game(void *arg)
+{
+    state_t *state = (state_t *)arg;
+
+    patch_record_t record;
+    if (patch_record_probe(state->selected_game->title_id, state->selected_game->path, &record) == 0)
+    {
+        // If the game is already patched to this server, there is nothing to do
+        if (record.has_server && strcmp(record.server_url, state->selected_server->url) == 0 && record.server_patch_digest == state->selected_server->patch_digest)
+        {
+            SDL_Log("%s is already patched to %s", state->selected_game->title_id, record.server_name);
+            finish_patching(state);
+            return;
+        }
+
+        // A game update replaced some of the modules, so their backups are of the old version and must not be decrypted
+        if (record.status == PATCH_STATUS_STALE)
+        {
+            SDL_Log("%s was updated since it was patched, backing it up again", state->selected_game->title_id);
+            patch_record_drop_stale_backups(state->selected_game->title_id, state->selected_game->path);
+        }
+    }
+
+    // Init libscetool, this only does any work the first time
+    ASSERT_ZERO(scetool_context_init(), "Unable to initialize libscetool");
+
+    // Get the path to the USRDIR
+    char usrdir_path[256] = {0};
+    snprintf(usrdir_path, 256, "%s/USRDIR", state->selected_game->path);
+
+    SDL_Log("Finding modules");
+
+    patch_module_t *modules = (patch_module_t *)malloc(sizeof(patch_module_t) * PATCH_MAX_MODULES);
+    ASSERT_NONZERO(modules, "Unable to allocate memory for modules");
+
+    int module_count = 0;
+    find_modules(state, usrdir_path, "", modules, &module_count);
+
+    // Find the EBOOT.BIN, which the content id and license are taken from
+    patch_module_t *eboot = NULL;
+    for (int i = 0; i < module_count; i++)
+    {
+        if (modules[i].is_eboot)
+            eboot = &modules[i];
+    }
+
+    if (eboot == NULL)
+    {
+        fail_patching(state, "Unable to find EBOOT.BIN.");
+        free(modules);
+        return;
+    }
+
+    // If we already know the URL will not fit, there is no point decrypting anything
+    int capacity = slot_index_get_capacity(state->selected_game->title_id, state->selected_game->path);
+    if (capacity >= 0 && strlen(state->selected_server->url) > capacity)
+    {
+        fail_patching(state, "URL too long to fit in EBOOT.");
+        free(modules);
+        return;
+    }
+
+    MUTEX_SCOPE(
+        state->patching_info.mutex,
+        {
+            state->patching_info.modules_total = module_count;
+            state->patching_info.modules_done = 0;
+        });
+
+    // If this is an NPDRM game, encrypt with the NPDRM options, otherwise with the disc options
+    scetool_context_t scetool;
+    scetool_context_create(&scetool, state->idps, state->selected_game->title_id[0] == 'N');
+
+    // Set the state to decrypting
+    set_patching_state(state, PATCHING_STATE_DECRYPTING);
+
+    SDL_Log("Getting content id");
+
+    // Get the content id, from the EBOOT.BIN itself if it hasn't been backed up yet
+    char *eboot_source_path = access(eboot->backup_path, F_OK) == 0 ? eboot->backup_path : eboot->path;
+
+    // Only the header needs to be read for this, so try the cache before asking scetool
+    self_info_t eboot_info;
+    char content_id[SELF_CONTENT_ID_LENGTH + 1] = {0};
+    bool has_content_id = false;
+    if (self_info_get(eboot_source_path, &eboot_info) == 0 && eboot_info.has_content_id)
+    {
+        memcpy(content_id, eboot_info.content_id, sizeof(content_id));
+        has_content_id = true;
+    }
+    else
+    {
+        has_content_id = scetool_read_content_id(eboot_source_path, content_id) == 0;
+    }
+
+    if (!has_content_id)
+    {
+        fail_patching(state, "Unable to get content id of executable.");
+        free(modules);
+        return;
+    }
+
+    SDL_Log("Content id: %.*s", 0x30, content_id);
+
+    // Only search for license if it's an NPDRM game
+    if (state->selected_game->title_id[0] == 'N')
+    {
+        SDL_Log("Finding license");
+
+        // Find the license
+        char *license_path = find_license_from_all_users(content_id);
+
+        // If the license is NULL
+        if (license_path == NULL)
+        {
+            fail_patching(state, "Unable to find license.");
+            free(modules);
+            return;
+        }
+
+        SDL_Log("Setting license paths");
+
+        int license_result = scetool_context_set_license_path(&scetool, license_path);
+
+        free(license_path);
+
+        if (license_result != 0)
+        {
+            fail_patching(state, "License path is too long.");
+            free(modules);
+            return;
+        }
+    }
+
+    // Ask the server which deltas it has once, rather than once per module
+    cJSON *delta_index = get_delta_index(state);
+
+    // Every module works from its own copy of the context, only the content id differs between them
+    for (int i = 0; i < module_count; i++)
+    {
+        modules[i].scetool = scetool;
+        modules[i].delta_index = delta_index;
+    }
+
+    // Patch every module as its own job, largest modules should not hold up the small ones
+    // Only the search, patch and verify work overlaps, decrypting and encrypting are still done one module at a time
+    job_pool_t pool;
+    ASSERT_ZERO(job_pool_create(&pool, module_count < PATCH_WORKER_COUNT ? module_count : PATCH_WORKER_COUNT, PATCH_WORKER_STACK_SIZE, "PATCHMOD"), "Unable to create patching job pool");
+
+    for (int i = 0; i < module_count; i++)
+        job_pool_submit(&pool, patch_module, &modules[i]);
+
+    job_pool_wait(&pool);
+    job_pool_destroy(&pool);
+
+    // If every module was searched, remember the URL slots we found for next time
+    bool all_scanned = true;
+    int slot_count = 0;
+    url_slot_t *slots = (url_slot_t *)malloc(sizeof(url_slot_t) * URL_SLOT_MAX * module_count);
+    ASSERT_NONZERO(slots, "Unable to allocate memory for URL slots");
+
+    for (int i = 0; i < module_count; i++)
+    {
+        all_scanned &= modules[i].scanned;
+
+        memcpy(slots + slot_count, modules[i].slots, sizeof(url_slot_t) * modules[i].slot_count);
+        slot_count += modules[i].slot_count;
+    }
+
+    if (all_scanned)
+        slot_index_store(state->selected_game->title_id, state->selected_game->path, slots, slot_count);
+
+    free(slots);
+
+    // If any module failed, throw away every output so nothing is committed
+    char *error = NULL;
+    for (int i = 0; i < module_count; i++)
+    {
+        if (modules[i].error != NULL && error == NULL)
+        {
+            SDL_Log("Patching %s failed: %s", modules[i].name, modules[i].error);
+            error = modules[i].error;
+        }
+    }
+
+    if (error == NULL && commit_modules(modules, module_count) != 0)
+        error = "Unable to move patched executables into place.";
+
+    if (error != NULL)
+    {
+        // commit_modules already put back anything it replaced, so the live modules are left alone and only our own files go
+        for (int i = 0; i < module_count; i++)
+        {
+            if (modules[i].has_output)
+                unlink(modules[i].output_path);
+
+            unlink(modules[i].decrypted_path);
+            unlink(modules[i].patched_path);
+        }
+
+        refresh_game_status(state);
+
+        fail_patching(state, error);
+        free(modules);
+        return;
+    }
+
+    // Remember what we patched the game to and every module we backed up, so patching it to the same server again can be skipped
+    char **module_names = (char **)malloc(sizeof(char *) * module_count);
+    ASSERT_NONZERO(module_names, "Unable to allocate memory for module names");
+
+    // Modules with nothing to patch are left alone without a backup, so there is nothing to record for them
+    int recorded_count = 0;
+    for (int i = 0; i < module_count; i++)
+    {
+        if (access(modules[i].backup_path, F_OK) == 0)
+            module_names[recorded_count++] = modules[i].name;
+    }
+
+    if (patch_record_store(state->selected_game->title_id, state->selected_game->path, state->selected_server, module_names, recorded_count) != 0)
+        SDL_Log("Unable to store patch record");
+
+    free(module_names);
+    free(modules);
+
+    refresh_game_status(state);
 
-    return;
-}
\ No newline at end of file
+    finish_patching(state);
+}
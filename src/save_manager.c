@@ -4,15 +4,15 @@
 
 #include "assert.h"
 #include "server_list.h"
+#include "save_manager.h"
 
-#define GAME_DIR "/dev_hdd0/game/REFRESHER/"
 #define SAVE_FILE_PATH GAME_DIR "refresher_servers.json"
 
 #define JSON_NAME_KEY "name"
 #define JSON_URL_KEY "url"
 #define JSON_PATCH_DIGEST_KEY "patch_digest"
 
-server_list_entry *load_saved_servers()
+void load_saved_servers(server_list_t *list)
 {
     // If the game dir does not exist, then create it
     if (access(GAME_DIR, F_OK) != 0)
@@ -35,7 +35,7 @@ server_list_entry *load_saved_servers()
         fclose(save_file);
 
         // Early return to save the hassle of reading the file
-        return NULL;
+        return;
     }
 
     // Try to open the save file
@@ -43,7 +43,7 @@ server_list_entry *load_saved_servers()
     if (save_file == NULL)
     {
         SDL_Log("Unable to open save file for reading");
-        return NULL;
+        return;
     }
 
     // Get its length
@@ -69,27 +69,24 @@ server_list_entry *load_saved_servers()
 
     // Parse the JSON
     cJSON *json = cJSON_Parse(save_file_data);
-    // If parsing the JSON failed, return NULL, as this should not be a failure condition
+    // If parsing the JSON failed, return, as this should not be a failure condition
     if (json == NULL)
     {
         SDL_Log("Error parsing JSON: %s", cJSON_GetErrorPtr());
 
-        return NULL;
+        return;
     }
 
-    // If the JSON is not an array, return NULL, as this should not be a failure condition
+    // If the JSON is not an array, return, as this should not be a failure condition
     if (!cJSON_IsArray(json))
     {
         SDL_Log("JSON is not an array");
 
         cJSON_Delete(json);
 
-        return NULL;
+        return;
     }
 
-    server_list_entry *first_entry = NULL;
-    server_list_entry *current_entry = NULL;
-
     // Iterate over the array
     cJSON *server = NULL;
     cJSON_ArrayForEach(server, json)
@@ -107,35 +104,24 @@ server_list_entry *load_saved_servers()
 
         SDL_Log("Name: %s, URL: %s, Patch Digest: %d", name->valuestring, url->valuestring, patch_digest->valueint);
 
-        // Create a new entry with the values from the file
-        server_list_entry *entry = server_list_entry_create(strdup(name->valuestring), strdup(url->valuestring), patch_digest->valueint);
-
-        // If the first entry is not set, set it
-        if (first_entry == NULL)
-            first_entry = entry;
-        // Otherwise, set the next entry of the current entry to the new entry
-        else
-            current_entry->next = entry;
-
-        // Update the current entry
-        current_entry = entry;
+        // Create a new entry with the values from the file, and add it to the end of the list
+        server_list_add(list, server_list_entry_create(name->valuestring, url->valuestring, patch_digest->valueint));
     }
 
     cJSON_Delete(json);
-
-    return first_entry;
 }
 
-int save_servers(server_list_entry *first_entry)
+int save_servers(server_list_entry **entries, int count)
 {
     // Create a JSON array
     cJSON *json = cJSON_CreateArray();
     ASSERT_NONZERO(json, "Unable to create JSON array");
 
-    // Iterate over the linked list
-    server_list_entry *current_entry = first_entry;
-    while (current_entry != NULL)
+    // Iterate over the servers
+    for (int i = 0; i < count; i++)
     {
+        server_list_entry *current_entry = entries[i];
+
         // Create a JSON object
         cJSON *server = cJSON_CreateObject();
 
@@ -146,9 +132,6 @@ int save_servers(server_list_entry *first_entry)
 
         // Add the object to the array
         cJSON_AddItemToArray(json, server);
-
-        // Move to the next entry
-        current_entry = current_entry->next;
     }
 
     // Convert the JSON to a string
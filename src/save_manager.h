@@ -1,4 +1,9 @@
+#pragma once
+
 #include "server_list.h"
 
-server_list_entry *load_saved_servers();
-int save_servers(server_list_entry *first_entry);
\ No newline at end of file
+// Directory all of our persistent files live in
+#define GAME_DIR "/dev_hdd0/game/REFRESHER/"
+
+void load_saved_servers(server_list_t *list);
+int save_servers(server_list_entry **entries, int count);
\ No newline at end of file
@@ -0,0 +1,124 @@
+#include <SDL2/SDL.h>
+#include <sys/mutex.h>
+
+#include "assert.h"
+#include "types.h"
+#include "scetool.h"
+#include "scetool_context.h"
+
+// scetool itself is driven through global setters, so only one context can be inside it at a time
+static bool initialized = false;
+static sys_lwmutex_t scetool_mutex;
+
+int scetool_context_init()
+{
+    // Loading the keys, curves and vsh tables is slow, and they never change, so only do it once
+    if (initialized)
+        return 0;
+
+    SDL_Log("Initializing libscetool");
+
+    int ret = libscetool_init();
+    if (ret != 0)
+        return ret;
+
+    sys_lwmutex_attr_t mutex_attr = {
+        .name = "SCETOOL",
+        .attr_protocol = SYS_LWMUTEX_PROTOCOL_FIFO,
+        .attr_recursive = SYS_LWMUTEX_ATTR_NOT_RECURSIVE,
+    };
+
+    ASSERT_ZERO(sysLwMutexCreate(&scetool_mutex, &mutex_attr), "Unable to create scetool mutex");
+
+    initialized = true;
+
+    return 0;
+}
+
+void scetool_context_create(scetool_context_t *context, char *idps, bool npdrm)
+{
+    memset(context, 0, sizeof(scetool_context_t));
+
+    memcpy(context->idps, idps, 16);
+    context->npdrm = npdrm;
+}
+
+int scetool_context_set_license_path(scetool_context_t *context, char *license_path)
+{
+    if (strlen(license_path) >= SCETOOL_LICENSE_PATH_LENGTH)
+        return -1;
+
+    strcpy(context->license_path, license_path);
+    context->has_license_path = true;
+
+    return 0;
+}
+
+void scetool_context_set_content_id(scetool_context_t *context, char *content_id)
+{
+    memcpy(context->content_id, content_id, SELF_CONTENT_ID_LENGTH);
+    context->content_id[SELF_CONTENT_ID_LENGTH] = '\0';
+    context->has_content_id = true;
+}
+
+// Pushes the whole context into scetool, nothing is left over from whoever used it last
+// Must be called with scetool_mutex held, and scetool keeps the pointers, so the context must outlive the call
+static void apply_context(scetool_context_t *context)
+{
+    set_idps_key(context->idps);
+
+    // Settings the context doesn't have are cleared back to scetool's defaults, rather than left pointing at the last caller's context
+    char *license_path = context->has_license_path ? context->license_path : NULL;
+    set_rif_file_path(license_path);
+    rap_set_directory(license_path);
+
+    set_npdrm_content_id(context->has_content_id ? context->content_id : NULL);
+}
+
+int scetool_read_content_id(char *file_path, char *content_id)
+{
+    int result = -1;
+
+    MUTEX_SCOPE(
+        &scetool_mutex,
+        {
+            // The returned pointer is scetool's own, and the next call overwrites it, so copy it out while locked
+            char *scetool_content_id = get_content_id(file_path);
+            if (scetool_content_id != NULL)
+            {
+                memcpy(content_id, scetool_content_id, SELF_CONTENT_ID_LENGTH);
+                content_id[SELF_CONTENT_ID_LENGTH] = '\0';
+                result = 0;
+            }
+        });
+
+    return result;
+}
+
+void scetool_decrypt(scetool_context_t *context, char *file_path, char *out_path)
+{
+    MUTEX_SCOPE(
+        &scetool_mutex,
+        {
+            apply_context(context);
+
+            frontend_decrypt(file_path, out_path);
+        });
+}
+
+void scetool_encrypt(scetool_context_t *context, char *file_path, char *out_path)
+{
+    MUTEX_SCOPE(
+        &scetool_mutex,
+        {
+            // The options reset parts of scetool's state, so the context is pushed after them
+            if (context->npdrm)
+                set_npdrm_encrypt_options();
+            else
+                set_disc_encrypt_options();
+
+            apply_context(context);
+
+            frontend_encrypt(file_path, out_path);
+        });
+}
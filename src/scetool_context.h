@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "self_header.h"
+
+#define SCETOOL_LICENSE_PATH_LENGTH 256
+
+// Everything scetool needs to know to decrypt or encrypt one file
+// Each caller owns its own context, which is pushed into scetool whole on every call.
+// This is not reentrant: scetool only has one set of globals, so every decrypt and encrypt still runs one at a time
+// behind a single lock. The context only gets callers ready for when scetool keeps its state per instance.
+typedef struct scetool_context_t
+{
+    char idps[16];
+    // Whether to encrypt with the NPDRM options, or the disc ones
+    bool npdrm;
+    bool has_license_path;
+    char license_path[SCETOOL_LICENSE_PATH_LENGTH];
+    bool has_content_id;
+    char content_id[SELF_CONTENT_ID_LENGTH + 1];
+} scetool_context_t;
+
+int scetool_context_init();
+void scetool_context_create(scetool_context_t *context, char *idps, bool npdrm);
+int scetool_context_set_license_path(scetool_context_t *context, char *license_path);
+void scetool_context_set_content_id(scetool_context_t *context, char *content_id);
+int scetool_read_content_id(char *file_path, char *content_id);
+void scetool_decrypt(scetool_context_t *context, char *file_path, char *out_path);
+void scetool_encrypt(scetool_context_t *context, char *file_path, char *out_path);
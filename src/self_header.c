@@ -0,0 +1,179 @@
+#include <SDL2/SDL.h>
+#include <stdio.h>
+#include <sys/stat.h>
+
+#include "endian.h"
+#include "self_header.h"
+
+// https://psdevwiki.com/ps3/SELF_-_SPRX
+#define SCE_MAGIC 0x53434500
+#define SCE_HEADER_SIZE 0x20
+#define SELF_EXT_HEADER_SIZE 0x50
+#define SELF_SECTION_INFO_SIZE 0x20
+#define SELF_APP_INFO_SIZE 0x20
+
+#define ELF_HEADER_SIZE 0x40
+
+#define CONTROL_INFO_HEADER_SIZE 0x10
+#define CONTROL_INFO_TYPE_NPDRM 3
+// type, size, next, magic, version, license, app type
+#define CONTROL_INFO_NPDRM_CONTENT_ID_OFFSET 0x20
+
+// Whether [offset, offset + length) lies inside the header we read
+static bool in_header(self_header_t *header, uint64_t offset, uint64_t length)
+{
+    return offset <= header->size && length <= header->size - offset;
+}
+
+static int self_header_parse(self_header_t *header)
+{
+    uint8_t *data = header->data;
+
+    header->app_info_offset = _BE64(data + 0x28);
+    header->elf_offset = _BE64(data + 0x30);
+    header->phdr_offset = _BE64(data + 0x38);
+    header->section_info_offset = _BE64(data + 0x48);
+    header->control_info_offset = _BE64(data + 0x58);
+    header->control_info_size = _BE64(data + 0x60);
+
+    if (!in_header(header, header->app_info_offset, SELF_APP_INFO_SIZE))
+    {
+        SDL_Log("SELF application info is out of range");
+        return -1;
+    }
+
+    header->auth_id = _BE64(data + header->app_info_offset);
+    header->self_type = _BE32(data + header->app_info_offset + 0x0C);
+    header->app_version = _BE64(data + header->app_info_offset + 0x10);
+
+    if (!in_header(header, header->elf_offset, ELF_HEADER_SIZE))
+    {
+        SDL_Log("SELF ELF header is out of range");
+        return -1;
+    }
+
+    header->phentsize = _BE16(data + header->elf_offset + 0x36);
+    header->phnum = _BE16(data + header->elf_offset + 0x38);
+
+    if (!in_header(header, header->phdr_offset, (uint64_t)header->phnum * header->phentsize) ||
+        !in_header(header, header->section_info_offset, (uint64_t)header->phnum * SELF_SECTION_INFO_SIZE))
+    {
+        SDL_Log("SELF program headers are out of range");
+        return -1;
+    }
+
+    // Walk the control info looking for the NPDRM block, which holds the content id
+    if (in_header(header, header->control_info_offset, header->control_info_size))
+    {
+        uint64_t position = header->control_info_offset;
+        uint64_t end = header->control_info_offset + header->control_info_size;
+
+        while (position + CONTROL_INFO_HEADER_SIZE <= end)
+        {
+            uint32_t type = _BE32(data + position);
+            uint32_t size = _BE32(data + position + 4);
+
+            if (size < CONTROL_INFO_HEADER_SIZE || size > end - position)
+                break;
+
+            if (type == CONTROL_INFO_TYPE_NPDRM && size >= CONTROL_INFO_NPDRM_CONTENT_ID_OFFSET + SELF_CONTENT_ID_LENGTH)
+            {
+                memcpy(header->content_id, data + position + CONTROL_INFO_NPDRM_CONTENT_ID_OFFSET, SELF_CONTENT_ID_LENGTH);
+                header->content_id[SELF_CONTENT_ID_LENGTH] = '\0';
+                header->has_content_id = true;
+            }
+
+            // The next field says whether another block follows
+            if (_BE64(data + position + 8) == 0)
+                break;
+
+            position += size;
+        }
+    }
+
+    return 0;
+}
+
+int self_header_read(const char *path, self_header_t *header)
+{
+    memset(header, 0, sizeof(self_header_t));
+
+    struct stat file_stat;
+    if (stat(path, &file_stat) != 0)
+        return -1;
+
+    header->file_size = file_stat.st_size;
+
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+        return -1;
+
+    header->size = header->file_size < SELF_HEADER_READ_SIZE ? header->file_size : SELF_HEADER_READ_SIZE;
+    header->data = (uint8_t *)malloc(header->size);
+    if (header->data == NULL)
+    {
+        fclose(file);
+        return -1;
+    }
+
+    // Read the start of the file in one go
+    if (header->size < SCE_HEADER_SIZE + SELF_EXT_HEADER_SIZE || fread(header->data, 1, header->size, file) != header->size)
+        goto fail;
+
+    // Check for header of SCE\0
+    if (_BE32(header->data) != SCE_MAGIC)
+        goto fail;
+
+    header->header_len = _BE64(header->data + 0x10);
+
+    // In the rare case the header is bigger than our first read, read the rest of it
+    if (header->header_len > header->size && header->header_len <= SELF_HEADER_MAX_SIZE && header->header_len <= header->file_size)
+    {
+        uint8_t *data = (uint8_t *)realloc(header->data, header->header_len);
+        if (data == NULL)
+            goto fail;
+
+        header->data = data;
+
+        if (fread(header->data + header->size, 1, header->header_len - header->size, file) != header->header_len - header->size)
+            goto fail;
+
+        header->size = header->header_len;
+    }
+
+    fclose(file);
+
+    if (self_header_parse(header) != 0)
+    {
+        self_header_free(header);
+        return -1;
+    }
+
+    return 0;
+
+fail:
+    fclose(file);
+    self_header_free(header);
+    return -1;
+}
+
+void self_header_free(self_header_t *header)
+{
+    free(header->data);
+    header->data = NULL;
+}
+
+bool self_header_get_section(self_header_t *header, int index, self_section_t *section)
+{
+    if (index < 0 || index >= header->phnum)
+        return false;
+
+    const uint8_t *info = header->data + header->section_info_offset + index * SELF_SECTION_INFO_SIZE;
+
+    section->offset = _BE64(info);
+    section->size = _BE64(info + 0x08);
+    section->compressed = _BE32(info + 0x10) == 2;
+    section->encrypted = _BE32(info + 0x1C) == 1;
+
+    return true;
+}
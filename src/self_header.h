@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define SELF_CONTENT_ID_LENGTH 0x30
+
+// How much of the file we read up front, which covers the whole header of practically every SELF
+#define SELF_HEADER_READ_SIZE 0x1000
+// Headers claiming to be bigger than this are treated as corrupt
+#define SELF_HEADER_MAX_SIZE 0x40000
+
+// https://psdevwiki.com/ps3/SELF_-_SPRX#Application_Info
+#define SELF_TYPE_APP 4
+#define SELF_TYPE_NPDRM 8
+
+typedef struct self_section_t
+{
+    uint64_t offset;
+    uint64_t size;
+    bool compressed;
+    bool encrypted;
+} self_section_t;
+
+// The plaintext parts of a SELF header, everything before the encrypted metadata
+typedef struct self_header_t
+{
+    // The raw header bytes, every offset below is into this
+    uint8_t *data;
+    size_t size;
+    uint64_t file_size;
+    uint64_t header_len;
+    uint64_t app_info_offset;
+    uint64_t elf_offset;
+    uint64_t phdr_offset;
+    uint64_t section_info_offset;
+    uint64_t control_info_offset;
+    uint64_t control_info_size;
+    // Copied out of the application info
+    uint64_t auth_id;
+    uint32_t self_type;
+    uint64_t app_version;
+    // Copied out of the ELF header embedded in the SELF
+    uint16_t phnum;
+    uint16_t phentsize;
+    bool has_content_id;
+    char content_id[SELF_CONTENT_ID_LENGTH + 1];
+} self_header_t;
+
+int self_header_read(const char *path, self_header_t *header);
+void self_header_free(self_header_t *header);
+bool self_header_get_section(self_header_t *header, int index, self_section_t *section);
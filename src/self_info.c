@@ -0,0 +1,124 @@
+#include <SDL2/SDL.h>
+#include <sys/stat.h>
+
+#include "assert.h"
+#include "types.h"
+#include "self_info.h"
+
+typedef struct self_info_entry
+{
+    struct self_info_entry *next;
+    char *path;
+    // The entry is only valid while the file looks the same as when it was read
+    uint64_t size;
+    time_t mtime;
+    self_info_t info;
+} self_info_entry;
+
+// Looked up by the game scan and every patching worker
+static self_info_entry *self_info_cache = NULL;
+static sys_lwmutex_t self_info_mutex;
+
+void self_info_init()
+{
+    sys_lwmutex_attr_t mutex_attr = {
+        .name = "SELFINFO",
+        .attr_protocol = SYS_LWMUTEX_PROTOCOL_FIFO,
+        .attr_recursive = SYS_LWMUTEX_ATTR_NOT_RECURSIVE,
+    };
+
+    ASSERT_ZERO(sysLwMutexCreate(&self_info_mutex, &mutex_attr), "Unable to create SELF info mutex");
+}
+
+static int read_self_info(const char *path, self_info_t *info)
+{
+    self_header_t header;
+    if (self_header_read(path, &header) != 0)
+        return -1;
+
+    memset(info, 0, sizeof(self_info_t));
+
+    info->self_type = header.self_type;
+    info->app_version = header.app_version;
+    info->section_count = header.phnum;
+
+    for (int i = 0; i < header.phnum; i++)
+    {
+        self_section_t section;
+        if (self_header_get_section(&header, i, &section) && section.compressed)
+            info->compressed_count++;
+    }
+
+    info->has_content_id = header.has_content_id;
+    memcpy(info->content_id, header.content_id, sizeof(info->content_id));
+
+    self_header_free(&header);
+
+    return 0;
+}
+
+int self_info_get(const char *path, self_info_t *info)
+{
+    struct stat file_stat;
+    if (stat(path, &file_stat) != 0)
+        return -1;
+
+    bool found = false;
+
+    MUTEX_SCOPE(
+        &self_info_mutex,
+        {
+            for (self_info_entry *entry = self_info_cache; entry != NULL; entry = entry->next)
+            {
+                if (strcmp(entry->path, path) == 0 && entry->size == (uint64_t)file_stat.st_size && entry->mtime == file_stat.st_mtime)
+                {
+                    (*info) = entry->info;
+                    found = true;
+                    break;
+                }
+            }
+        });
+
+    if (found)
+        return 0;
+
+    // Read outside the lock, so a slow disk doesn't hold up other lookups
+    if (read_self_info(path, info) != 0)
+        return -1;
+
+    MUTEX_SCOPE(
+        &self_info_mutex,
+        {
+            // Reuse the entry for this path if the file changed since it was cached
+            self_info_entry *entry = self_info_cache;
+            while (entry != NULL && strcmp(entry->path, path) != 0)
+                entry = entry->next;
+
+            if (entry == NULL)
+            {
+                entry = (self_info_entry *)malloc(sizeof(self_info_entry));
+                ASSERT_NONZERO(entry, "Unable to allocate SELF info entry");
+
+                entry->path = strdup(path);
+                ASSERT_NONZERO(entry->path, "Unable to allocate SELF info path");
+
+                entry->next = self_info_cache;
+                self_info_cache = entry;
+            }
+
+            entry->size = file_stat.st_size;
+            entry->mtime = file_stat.st_mtime;
+            entry->info = (*info);
+        });
+
+    return 0;
+}
+
+bool self_info_is_patchable(self_info_t *info)
+{
+    // NPDRM executables can't be signed again without the content id of their license
+    if (info->self_type == SELF_TYPE_NPDRM)
+        return info->has_content_id;
+
+    return info->self_type == SELF_TYPE_APP;
+}
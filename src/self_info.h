@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "self_header.h"
+
+// The few facts about a SELF the UI and patcher care about, all read from the plaintext header
+typedef struct self_info_t
+{
+    uint32_t self_type;
+    uint64_t app_version;
+    // Number of sections, and how many of them are compressed
+    int section_count;
+    int compressed_count;
+    bool has_content_id;
+    char content_id[SELF_CONTENT_ID_LENGTH + 1];
+} self_info_t;
+
+void self_info_init();
+int self_info_get(const char *path, self_info_t *info);
+bool self_info_is_patchable(self_info_t *info);
@@ -10,7 +10,6 @@ server_list_entry *server_list_entry_create(char *name, char *url, bool patch_di
     entry->name = strdup(name);
     entry->url = strdup(url);
     entry->patch_digest = patch_digest;
-    entry->next = NULL;
     return entry;
 }
 
@@ -21,15 +20,31 @@ void server_list_entry_destroy(server_list_entry *entry)
     free(entry);
 }
 
-int count_server_list_entries(server_list_entry *head)
+void server_list_init(server_list_t *list)
 {
-    int count = 0;
-    server_list_entry *current = head;
-    while (current != NULL)
+    memset(list, 0, sizeof(server_list_t));
+}
+
+void server_list_add(server_list_t *list, server_list_entry *entry)
+{
+    if (list->count == list->capacity)
     {
-        count++;
+        list->capacity = list->capacity == 0 ? 16 : list->capacity * 2;
 
-        current = current->next;
+        list->entries = (server_list_entry **)realloc(list->entries, sizeof(server_list_entry *) * list->capacity);
+        ASSERT_NONZERO(list->entries, "Failed to allocate memory for server list");
     }
-    return count;
-}
\ No newline at end of file
+
+    list->entries[list->count++] = entry;
+}
+
+void server_list_remove(server_list_t *list, int index)
+{
+    if (index < 0 || index >= list->count)
+        return;
+
+    server_list_entry_destroy(list->entries[index]);
+
+    memmove(list->entries + index, list->entries + index + 1, sizeof(server_list_entry *) * (list->count - index - 1));
+    list->count--;
+}
@@ -8,16 +8,25 @@
 
 typedef struct server_list_entry
 {
-    struct server_list_entry *next;
     char *name;
     char *url;
     bool patch_digest;
 } server_list_entry;
 
+typedef struct server_list_t
+{
+    // In the order they are shown
+    server_list_entry **entries;
+    int count;
+    int capacity;
+} server_list_t;
+
 server_list_entry *server_list_entry_create(char *name, char *url, bool patch_digest);
 
 void server_list_entry_destroy(server_list_entry *entry);
 
-int count_server_list_entries(server_list_entry *head);
+void server_list_init(server_list_t *list);
+void server_list_add(server_list_t *list, server_list_entry *entry);
+void server_list_remove(server_list_t *list, int index);
 
-#endif
\ No newline at end of file
+#endif
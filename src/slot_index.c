@@ -0,0 +1,191 @@
+#include <SDL2/SDL.h>
+#include <sys/stat.h>
+#include <cJSON.h>
+
+#include "assert.h"
+#include "types.h"
+#include "save_manager.h"
+#include "slot_index.h"
+
+#define SLOT_INDEX_PATH GAME_DIR "url_slots.json"
+
+#define JSON_TITLE_ID_KEY "title_id"
+#define JSON_EBOOT_SIZE_KEY "eboot_size"
+#define JSON_EBOOT_MTIME_KEY "eboot_mtime"
+#define JSON_CAPACITY_KEY "capacity"
+#define JSON_SLOTS_KEY "slots"
+#define JSON_MODULE_KEY "module"
+#define JSON_OFFSET_KEY "offset"
+
+// The parsed index, read by the UI thread and written by the patching thread
+static cJSON *slot_index = NULL;
+static sys_lwmutex_t slot_index_mutex;
+
+// The slots are always found in the backup, since that is what gets decrypted
+static int stat_eboot(char *game_path, struct stat *eboot_stat)
+{
+    char eboot_path[256] = {0};
+    snprintf(eboot_path, 256, "%s/USRDIR/EBOOT.BIN.ORIG", game_path);
+
+    return stat(eboot_path, eboot_stat);
+}
+
+static cJSON *find_entry(char *title_id, int *index)
+{
+    int i = 0;
+    cJSON *entry = NULL;
+    cJSON_ArrayForEach(entry, slot_index)
+    {
+        cJSON *entry_title_id = cJSON_GetObjectItemCaseSensitive(entry, JSON_TITLE_ID_KEY);
+
+        if (cJSON_IsString(entry_title_id) && strcmp(entry_title_id->valuestring, title_id) == 0)
+        {
+            if (index != NULL)
+                (*index) = i;
+
+            return entry;
+        }
+
+        i++;
+    }
+
+    return NULL;
+}
+
+void slot_index_load()
+{
+    sys_lwmutex_attr_t mutex_attr = {
+        .name = "SLOTIDX",
+        .attr_protocol = SYS_LWMUTEX_PROTOCOL_FIFO,
+        .attr_recursive = SYS_LWMUTEX_ATTR_NOT_RECURSIVE,
+    };
+
+    ASSERT_ZERO(sysLwMutexCreate(&slot_index_mutex, &mutex_attr), "Unable to create slot index mutex");
+
+    FILE *file = fopen(SLOT_INDEX_PATH, "r");
+    if (file != NULL)
+    {
+        // Get its length
+        fseek(file, 0, SEEK_END);
+        size_t file_size = ftell(file);
+        fseek(file, 0, SEEK_SET);
+
+        char *file_data = (char *)malloc(file_size);
+        ASSERT_NONZERO(file_data, "Unable to allocate memory for slot index");
+
+        if (fread(file_data, sizeof(char), file_size, file) == file_size)
+            slot_index = cJSON_ParseWithLength(file_data, file_size);
+
+        fclose(file);
+        free(file_data);
+    }
+
+    // A missing or broken index just means every game gets scanned again
+    if (!cJSON_IsArray(slot_index))
+    {
+        cJSON_Delete(slot_index);
+        slot_index = cJSON_CreateArray();
+        ASSERT_NONZERO(slot_index, "Unable to create JSON array");
+    }
+}
+
+int slot_index_get_capacity(char *title_id, char *game_path)
+{
+    struct stat eboot_stat;
+    if (stat_eboot(game_path, &eboot_stat) != 0)
+        return -1;
+
+    int capacity = -1;
+
+    MUTEX_SCOPE(
+        &slot_index_mutex,
+        {
+            cJSON *entry = find_entry(title_id, NULL);
+            if (entry != NULL)
+            {
+                cJSON *eboot_size = cJSON_GetObjectItemCaseSensitive(entry, JSON_EBOOT_SIZE_KEY);
+                cJSON *eboot_mtime = cJSON_GetObjectItemCaseSensitive(entry, JSON_EBOOT_MTIME_KEY);
+                cJSON *entry_capacity = cJSON_GetObjectItemCaseSensitive(entry, JSON_CAPACITY_KEY);
+
+                // Only trust the entry if it was made from the EBOOT that is installed now
+                if (cJSON_IsNumber(eboot_size) && cJSON_IsNumber(eboot_mtime) && cJSON_IsNumber(entry_capacity) &&
+                    (uint64_t)eboot_size->valuedouble == (uint64_t)eboot_stat.st_size &&
+                    (uint64_t)eboot_mtime->valuedouble == (uint64_t)eboot_stat.st_mtime)
+                {
+                    capacity = entry_capacity->valueint;
+                }
+            }
+        });
+
+    return capacity;
+}
+
+int slot_index_store(char *title_id, char *game_path, url_slot_t *slots, int slot_count)
+{
+    struct stat eboot_stat;
+    if (stat_eboot(game_path, &eboot_stat) != 0)
+        return -1;
+
+    // The smallest slot decides which URLs fit, since every slot gets patched
+    int capacity = -1;
+    for (int i = 0; i < slot_count; i++)
+    {
+        if (capacity < 0 || slots[i].capacity < capacity)
+            capacity = slots[i].capacity;
+    }
+
+    SDL_Log("Storing %d URL slots for %s, capacity %d", slot_count, title_id, capacity);
+
+    cJSON *entry = cJSON_CreateObject();
+    ASSERT_NONZERO(entry, "Unable to create JSON object");
+
+    cJSON_AddItemToObject(entry, JSON_TITLE_ID_KEY, cJSON_CreateString(title_id));
+    cJSON_AddItemToObject(entry, JSON_EBOOT_SIZE_KEY, cJSON_CreateNumber(eboot_stat.st_size));
+    cJSON_AddItemToObject(entry, JSON_EBOOT_MTIME_KEY, cJSON_CreateNumber(eboot_stat.st_mtime));
+    cJSON_AddItemToObject(entry, JSON_CAPACITY_KEY, cJSON_CreateNumber(capacity));
+
+    cJSON *json_slots = cJSON_CreateArray();
+    for (int i = 0; i < slot_count; i++)
+    {
+        cJSON *slot = cJSON_CreateObject();
+
+        cJSON_AddItemToObject(slot, JSON_MODULE_KEY, cJSON_CreateString(slots[i].module));
+        cJSON_AddItemToObject(slot, JSON_OFFSET_KEY, cJSON_CreateNumber(slots[i].offset));
+        cJSON_AddItemToObject(slot, JSON_CAPACITY_KEY, cJSON_CreateNumber(slots[i].capacity));
+
+        cJSON_AddItemToArray(json_slots, slot);
+    }
+    cJSON_AddItemToObject(entry, JSON_SLOTS_KEY, json_slots);
+
+    char *json_string = NULL;
+
+    MUTEX_SCOPE(
+        &slot_index_mutex,
+        {
+            // Replace any old entry for this game
+            int index;
+            if (find_entry(title_id, &index) != NULL)
+                cJSON_DeleteItemFromArray(slot_index, index);
+
+            cJSON_AddItemToArray(slot_index, entry);
+
+            json_string = cJSON_Print(slot_index);
+        });
+
+    ASSERT_NONZERO(json_string, "Unable to convert JSON to string");
+
+    FILE *file = fopen(SLOT_INDEX_PATH, "w");
+    if (file == NULL)
+    {
+        SDL_Log("Unable to open slot index for writing");
+        cJSON_free(json_string);
+        return -1;
+    }
+
+    fputs(json_string, file);
+    fclose(file);
+
+    cJSON_free(json_string);
+
+    return 0;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stdint.h>
+
+// Upper bound on how many URL slots we remember per executable
+#define URL_SLOT_MAX 32
+
+typedef struct url_slot_t
+{
+    // Name of the executable the slot lives in, relative to USRDIR
+    const char *module;
+    uint32_t offset;
+    // Longest URL that fits in the slot, string length plus trailing NULs minus the terminator
+    int capacity;
+} url_slot_t;
+
+void slot_index_load();
+int slot_index_get_capacity(char *title_id, char *game_path);
+int slot_index_store(char *title_id, char *game_path, url_slot_t *slots, int slot_count);
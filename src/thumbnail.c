@@ -0,0 +1,421 @@
+#include <SDL2/SDL.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/thread.h>
+#include <sys/cond.h>
+#include <sysmodule/sysmodule.h>
+#include <pngdec/pngdec.h>
+
+#include "assert.h"
+#include "types.h"
+#include "save_manager.h"
+#include "thumbnail.h"
+
+// Pre-scaled thumbnails are kept here, so each ICON0.PNG only ever gets decoded once
+#define THUMBNAIL_DIR GAME_DIR "thumbnails/"
+#define THUMBNAIL_MAGIC 0x54484D43
+
+// How many thumbnails are kept at once, a few screens worth, no matter how many games there are
+#define THUMBNAIL_CACHE_SIZE 48
+
+typedef enum THUMBNAIL_STATE
+{
+    THUMBNAIL_STATE_EMPTY = 0,
+    // Waiting for the worker to pick it up
+    THUMBNAIL_STATE_QUEUED,
+    // The worker is loading it, so the slot can't be reused until it is done
+    THUMBNAIL_STATE_DECODING,
+    // Pixels are loaded, and waiting to be turned into a texture on the main thread
+    THUMBNAIL_STATE_READY,
+    THUMBNAIL_STATE_LOADED,
+    // There is no icon, or it couldn't be read, so don't try again
+    THUMBNAIL_STATE_FAILED,
+} THUMBNAIL_STATE;
+
+typedef struct thumbnail_slot_t
+{
+    THUMBNAIL_STATE state;
+    char game_path[256];
+    // When the slot was last asked for, the least recently used slot is reused first
+    uint32_t last_used;
+    uint32_t *pixels;
+    SDL_Texture *texture;
+} thumbnail_slot_t;
+
+typedef struct thumbnail_file_header_t
+{
+    uint32_t magic;
+    uint32_t width;
+    uint32_t height;
+    // The ICON0.PNG the thumbnail was made from
+    uint64_t icon_size;
+    uint64_t icon_mtime;
+    // Files are named by a hash of this, which two games can share
+    char game_path[256];
+} thumbnail_file_header_t;
+
+static thumbnail_slot_t thumbnail_slots[THUMBNAIL_CACHE_SIZE];
+static uint32_t thumbnail_clock = 0;
+static bool thumbnail_running = false;
+static bool thumbnail_stopping = false;
+static sys_lwmutex_t thumbnail_mutex;
+static sys_lwcond_t thumbnail_cond;
+static sys_ppu_thread_t thumbnail_thread;
+
+static uint32_t hash_path(const char *path)
+{
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (const char *c = path; *c != '\0'; c++)
+    {
+        hash ^= (uint8_t)*c;
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+// Averages every source pixel under each thumbnail pixel, so small text in the icon doesn't shimmer
+static uint32_t *scale_icon(pngData *png)
+{
+    uint32_t *pixels = (uint32_t *)malloc(THUMBNAIL_WIDTH * THUMBNAIL_HEIGHT * sizeof(uint32_t));
+    ASSERT_NONZERO(pixels, "Unable to allocate memory for thumbnail");
+
+    for (int y = 0; y < THUMBNAIL_HEIGHT; y++)
+    {
+        uint32_t y0 = y * png->height / THUMBNAIL_HEIGHT;
+        uint32_t y1 = (y + 1) * png->height / THUMBNAIL_HEIGHT;
+        if (y1 <= y0)
+            y1 = y0 + 1;
+
+        for (int x = 0; x < THUMBNAIL_WIDTH; x++)
+        {
+            uint32_t x0 = x * png->width / THUMBNAIL_WIDTH;
+            uint32_t x1 = (x + 1) * png->width / THUMBNAIL_WIDTH;
+            if (x1 <= x0)
+                x1 = x0 + 1;
+
+            uint32_t sum[4] = {0};
+            for (uint32_t sy = y0; sy < y1; sy++)
+            {
+                const uint32_t *row = (const uint32_t *)((const uint8_t *)png->bmp_out + sy * png->pitch);
+                for (uint32_t sx = x0; sx < x1; sx++)
+                {
+                    for (int channel = 0; channel < 4; channel++)
+                        sum[channel] += (row[sx] >> (channel * 8)) & 0xFF;
+                }
+            }
+
+            uint32_t count = (y1 - y0) * (x1 - x0);
+            uint32_t pixel = 0;
+            for (int channel = 0; channel < 4; channel++)
+                pixel |= (sum[channel] / count) << (channel * 8);
+
+            pixels[y * THUMBNAIL_WIDTH + x] = pixel;
+        }
+    }
+
+    return pixels;
+}
+
+static uint32_t *read_thumbnail_file(const char *path, const char *game_path, struct stat *icon_stat)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+        return NULL;
+
+    thumbnail_file_header_t header;
+    uint32_t *pixels = NULL;
+
+    // Only use it if it was made for this game from the icon that is there now, at the size we draw at
+    if (fread(&header, sizeof(header), 1, file) == 1 &&
+        header.magic == THUMBNAIL_MAGIC &&
+        strncmp(header.game_path, game_path, sizeof(header.game_path)) == 0 &&
+        header.width == THUMBNAIL_WIDTH &&
+        header.height == THUMBNAIL_HEIGHT &&
+        header.icon_size == (uint64_t)icon_stat->st_size &&
+        header.icon_mtime == (uint64_t)icon_stat->st_mtime)
+    {
+        pixels = (uint32_t *)malloc(THUMBNAIL_WIDTH * THUMBNAIL_HEIGHT * sizeof(uint32_t));
+        ASSERT_NONZERO(pixels, "Unable to allocate memory for thumbnail");
+
+        if (fread(pixels, sizeof(uint32_t), THUMBNAIL_WIDTH * THUMBNAIL_HEIGHT, file) != THUMBNAIL_WIDTH * THUMBNAIL_HEIGHT)
+        {
+            free(pixels);
+            pixels = NULL;
+        }
+    }
+
+    fclose(file);
+
+    return pixels;
+}
+
+static void write_thumbnail_file(const char *path, const char *game_path, struct stat *icon_stat, uint32_t *pixels)
+{
+    FILE *file = fopen(path, "wb");
+    if (file == NULL)
+    {
+        SDL_Log("Unable to open %s for writing", path);
+        return;
+    }
+
+    thumbnail_file_header_t header = {
+        .magic = THUMBNAIL_MAGIC,
+        .width = THUMBNAIL_WIDTH,
+        .height = THUMBNAIL_HEIGHT,
+        .icon_size = icon_stat->st_size,
+        .icon_mtime = icon_stat->st_mtime,
+    };
+
+    snprintf(header.game_path, sizeof(header.game_path), "%s", game_path);
+
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                   fwrite(pixels, sizeof(uint32_t), THUMBNAIL_WIDTH * THUMBNAIL_HEIGHT, file) == THUMBNAIL_WIDTH * THUMBNAIL_HEIGHT;
+
+    fclose(file);
+
+    // Never leave a half written thumbnail behind
+    if (!written)
+        unlink(path);
+}
+
+static uint32_t *load_thumbnail(const char *game_path)
+{
+    char icon_path[256] = {0};
+    snprintf(icon_path, 256, "%s/ICON0.PNG", game_path);
+
+    struct stat icon_stat;
+    if (stat(icon_path, &icon_stat) != 0)
+        return NULL;
+
+    char thumbnail_path[256] = {0};
+    snprintf(thumbnail_path, 256, THUMBNAIL_DIR "%08x.raw", hash_path(game_path));
+
+    // Try the one we scaled last time first, a game whose path hashes the same just takes the file over
+    uint32_t *pixels = read_thumbnail_file(thumbnail_path, game_path, &icon_stat);
+    if (pixels != NULL)
+        return pixels;
+
+    pngData png;
+    if (pngLoadFromFile(icon_path, &png) != 0 || png.bmp_out == NULL)
+    {
+        SDL_Log("Unable to decode %s", icon_path);
+        return NULL;
+    }
+
+    pixels = scale_icon(&png);
+    free(png.bmp_out);
+
+    write_thumbnail_file(thumbnail_path, game_path, &icon_stat, pixels);
+
+    return pixels;
+}
+
+// The queued slot asked for most recently, since that one is most likely to be on screen
+static thumbnail_slot_t *next_queued_slot()
+{
+    thumbnail_slot_t *next = NULL;
+    for (int i = 0; i < THUMBNAIL_CACHE_SIZE; i++)
+    {
+        thumbnail_slot_t *slot = &thumbnail_slots[i];
+
+        if (slot->state == THUMBNAIL_STATE_QUEUED && (next == NULL || slot->last_used > next->last_used))
+            next = slot;
+    }
+
+    return next;
+}
+
+static void thumbnail_worker(void *arg)
+{
+    ASSERT_ZERO(sysLwMutexLock(&thumbnail_mutex, 0), "Unable to lock thumbnail mutex");
+
+    while (true)
+    {
+        // Sleep until there is a thumbnail to load
+        thumbnail_slot_t *slot;
+        while (!thumbnail_stopping && (slot = next_queued_slot()) == NULL)
+            ASSERT_ZERO(sysLwCondWait(&thumbnail_cond, 0), "Unable to wait on thumbnail condition");
+
+        if (thumbnail_stopping)
+            break;
+
+        slot->state = THUMBNAIL_STATE_DECODING;
+
+        char game_path[256];
+        strcpy(game_path, slot->game_path);
+
+        // Don't hold the lock while reading, so the main thread never waits on a decode
+        ASSERT_ZERO(sysLwMutexUnlock(&thumbnail_mutex), "Unable to unlock thumbnail mutex");
+
+        uint32_t *pixels = load_thumbnail(game_path);
+
+        ASSERT_ZERO(sysLwMutexLock(&thumbnail_mutex, 0), "Unable to lock thumbnail mutex");
+
+        // Decoding slots are never reused, so this is still the same game
+        slot->pixels = pixels;
+        slot->state = pixels != NULL ? THUMBNAIL_STATE_READY : THUMBNAIL_STATE_FAILED;
+    }
+
+    ASSERT_ZERO(sysLwMutexUnlock(&thumbnail_mutex), "Unable to unlock thumbnail mutex");
+
+    sysThreadExit(0);
+}
+
+static void clear_slot(thumbnail_slot_t *slot)
+{
+    free(slot->pixels);
+
+    if (slot->texture != NULL)
+        SDL_DestroyTexture(slot->texture);
+
+    memset(slot, 0, sizeof(thumbnail_slot_t));
+}
+
+// Finds the slot for a game, queueing it to be loaded if it isn't in the cache
+// The thumbnail mutex must be held
+static thumbnail_slot_t *request_slot(char *game_path)
+{
+    thumbnail_slot_t *found = NULL;
+    thumbnail_slot_t *victim = NULL;
+
+    for (int i = 0; i < THUMBNAIL_CACHE_SIZE && found == NULL; i++)
+    {
+        thumbnail_slot_t *slot = &thumbnail_slots[i];
+
+        if (slot->state != THUMBNAIL_STATE_EMPTY && strcmp(slot->game_path, game_path) == 0)
+        {
+            found = slot;
+        }
+        // Use an empty slot if there is one, otherwise the least recently used one the worker isn't busy with
+        else if (slot->state != THUMBNAIL_STATE_DECODING &&
+                 (victim == NULL || (victim->state != THUMBNAIL_STATE_EMPTY && (slot->state == THUMBNAIL_STATE_EMPTY || slot->last_used < victim->last_used))))
+        {
+            victim = slot;
+        }
+    }
+
+    if (found == NULL)
+    {
+        // Every slot is being decoded, so try again next frame
+        if (victim == NULL)
+            return NULL;
+
+        clear_slot(victim);
+
+        victim->state = THUMBNAIL_STATE_QUEUED;
+        snprintf(victim->game_path, sizeof(victim->game_path), "%s", game_path);
+
+        ASSERT_ZERO(sysLwCondSignal(&thumbnail_cond), "Unable to signal thumbnail condition");
+
+        found = victim;
+    }
+
+    found->last_used = ++thumbnail_clock;
+
+    return found;
+}
+
+void thumbnail_init()
+{
+    // Without the PNG decoder, the list is just shown without icons
+    if (sysModuleLoad(SYSMODULE_PNGDEC) != 0)
+    {
+        SDL_Log("Unable to load PNG decoder module, thumbnails are disabled");
+        return;
+    }
+
+    if (access(THUMBNAIL_DIR, F_OK) != 0 && mkdir(THUMBNAIL_DIR, 0777) != 0)
+        SDL_Log("Unable to create thumbnail dir, thumbnails will not be kept");
+
+    sys_lwmutex_attr_t mutex_attr = {
+        .name = "THUMBS",
+        .attr_protocol = SYS_LWMUTEX_PROTOCOL_FIFO,
+        .attr_recursive = SYS_LWMUTEX_ATTR_NOT_RECURSIVE,
+    };
+
+    ASSERT_ZERO(sysLwMutexCreate(&thumbnail_mutex, &mutex_attr), "Unable to create thumbnail mutex");
+
+    sys_lwcond_attr_t cond_attr = {.name = "THUMBS"};
+    ASSERT_ZERO(sysLwCondCreate(&thumbnail_cond, &thumbnail_mutex, &cond_attr), "Unable to create thumbnail condition");
+
+    ASSERT_ZERO(sysThreadCreate(&thumbnail_thread, thumbnail_worker, NULL, 1000, 0x10000, THREAD_JOINABLE, "THUMBS"), "Unable to create thumbnail thread");
+
+    thumbnail_running = true;
+}
+
+void thumbnail_shutdown()
+{
+    if (!thumbnail_running)
+        return;
+
+    MUTEX_SCOPE(
+        &thumbnail_mutex,
+        {
+            thumbnail_stopping = true;
+            ASSERT_ZERO(sysLwCondSignal(&thumbnail_cond), "Unable to signal thumbnail condition");
+        });
+
+    uint64_t ret;
+    sysThreadJoin(thumbnail_thread, &ret);
+
+    for (int i = 0; i < THUMBNAIL_CACHE_SIZE; i++)
+        clear_slot(&thumbnail_slots[i]);
+
+    ASSERT_ZERO(sysLwCondDestroy(&thumbnail_cond), "Unable to destroy thumbnail condition");
+    ASSERT_ZERO(sysLwMutexDestroy(&thumbnail_mutex), "Unable to destroy thumbnail mutex");
+
+    // Only loaded if we got this far in thumbnail_init
+    sysModuleUnload(SYSMODULE_PNGDEC);
+
+    thumbnail_running = false;
+}
+
+void thumbnail_prefetch(char *game_path)
+{
+    if (!thumbnail_running)
+        return;
+
+    MUTEX_SCOPE(
+        &thumbnail_mutex,
+        {
+            request_slot(game_path);
+        });
+}
+
+SDL_Texture *thumbnail_get(SDL_Renderer *renderer, char *game_path)
+{
+    if (!thumbnail_running)
+        return NULL;
+
+    SDL_Texture *texture = NULL;
+
+    MUTEX_SCOPE(
+        &thumbnail_mutex,
+        {
+            thumbnail_slot_t *slot = request_slot(game_path);
+
+            // Textures can only be made on the thread that owns the renderer, so the worker leaves that to us
+            if (slot != NULL && slot->state == THUMBNAIL_STATE_READY)
+            {
+                slot->texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC, THUMBNAIL_WIDTH, THUMBNAIL_HEIGHT);
+
+                if (slot->texture != NULL)
+                {
+                    SDL_UpdateTexture(slot->texture, NULL, slot->pixels, THUMBNAIL_WIDTH * sizeof(uint32_t));
+                    SDL_SetTextureBlendMode(slot->texture, SDL_BLENDMODE_BLEND);
+                }
+
+                free(slot->pixels);
+                slot->pixels = NULL;
+                slot->state = slot->texture != NULL ? THUMBNAIL_STATE_LOADED : THUMBNAIL_STATE_FAILED;
+            }
+
+            if (slot != NULL && slot->state == THUMBNAIL_STATE_LOADED)
+                texture = slot->texture;
+        });
+
+    return texture;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <SDL2/SDL.h>
+
+// Thumbnails are scaled once to the size they are drawn at, so drawing one is a straight copy
+#define THUMBNAIL_WIDTH 54
+#define THUMBNAIL_HEIGHT 30
+
+void thumbnail_init();
+void thumbnail_shutdown();
+
+// Both of these must only be called from the thread that owns the renderer
+void thumbnail_prefetch(char *game_path);
+SDL_Texture *thumbnail_get(SDL_Renderer *renderer, char *game_path);
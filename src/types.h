@@ -81,9 +81,14 @@ typedef struct patching_info_t
 {
     bool is_running;
     sys_ppu_thread_t *thread;
+    // Whether thread has been started and not joined yet
+    bool has_thread;
     sys_lwmutex_t *mutex;
     PATCHING_STATE state;
     char *last_error;
+    // How many of the game's executables are being patched, and how many are finished
+    int modules_total;
+    int modules_done;
 } patching_info_t;
 
 typedef enum INPUT_STATE
@@ -92,6 +97,9 @@ typedef enum INPUT_STATE
     INPUT_STATE_AUTODISCOVER_URL,
     INPUT_STATE_NAME,
     INPUT_STATE_PATCH_URL,
+    INPUT_STATE_SEARCH,
+    // Waiting on the server to answer an autodiscover request
+    INPUT_STATE_CONTACTING_SERVER,
 } INPUT_STATE;
 
 typedef struct state_t
@@ -101,16 +109,30 @@ typedef struct state_t
     bool last_down;
     bool last_cross;
     bool last_circle;
-    uint32_t game_count;
-    game_list_entry *games;
-    server_list_entry *servers;
-    int server_count;
+    bool last_triangle;
+    bool last_square;
+    game_list_t games;
+    // Guards games, which the scan thread adds to while the UI is drawing them
+    sys_lwmutex_t *games_mutex;
+    // The game the selection was on, and the version of the view it was in, so the selection can follow it when the view changes
+    int highlighted_game_id;
+    uint32_t games_version;
+    sys_ppu_thread_t *scan_thread;
+    // Whether the scan thread is still looking for games
+    bool scanning;
+    server_list_t servers;
     STATE_SCENE scene;
     bool cross_pressed;
     bool circle_pressed;
+    bool triangle_pressed;
+    bool square_pressed;
     game_list_entry *selected_game;
+    // Longest server URL the selected game can take, or -1 if we don't know yet
+    int url_capacity;
     server_list_entry *selected_server;
     patching_info_t patching_info;
+    // Shared with autodiscover, used to fetch deltas from the server while patching
+    struct http_pool_t *http_pool;
     char idps[16];
     // Wrap menu after this many times
     int wrap_count;